@@ -0,0 +1,1012 @@
+#include <string.h>
+#include "document.h"
+#include "undo.h"
+#include "search.h"
+
+/*
+    Document model of the edited file
+
+    Text is kept in a gap buffer: characters before the cursor sit at the start of the buffer,
+    characters after it at the end and the free space (gap) is in between,
+    so typing and deleting at the cursor doesn't move any text.
+    Gap is only moved when an edit happens somewhere else.
+
+    Text is made of paragraphs ending with a line break, which are cut into 16-character rows
+    (what the display shows and what a file stores in a line). Full row always continues
+    in the next one, so a paragraph of 16 characters takes a full row and an empty one.
+
+    Rows are found through a separate index of their start (buffer position of their first
+    character) and length. Starts of rows after the gap don't change when the gap grows
+    or shrinks, so an edit only updates rows of the paragraph it happened in, rows after it
+    are only moved in the index when the paragraph takes more or less rows.
+
+    Rows after the last paragraph aren't stored (they're empty), so the document
+    may have less rows than a file. FileData is only used to load and store it.
+
+    Loading doesn't copy anything, rows are read straight from the loaded file
+    until the first edit (or search) needs the text, only then it's built (copy on write).
+    A file that's only read never gets copied into the document.
+
+    Every edit is recorded in the undo history (see undo.c), undoing a step
+    applies it back the same way as an edit.
+*/
+
+// every row takes at most 16 characters (full one or a shorter one with its line break),
+// a full last row adds a line break and an edit that's taken back adds one more character
+#define TEXT_SIZE (DATA_SIZE + LINE_SIZE)
+// full last row is followed by an empty one, an edit can add one more before it's taken back
+#define MAX_ROWS (AMOUNT_OF_LINES + 2)
+#define BREAK ('\n')
+
+char text[TEXT_SIZE];
+int gap_start = 0;
+int gap_end = TEXT_SIZE;
+// buffer position of the first character (or line break) of every row
+uint16_t row_starts[MAX_ROWS];
+uint8_t row_lengths[MAX_ROWS];
+int rows = 0;
+// file the document was loaded from while the text isn't built yet, NULL after that
+const FileData* base = NULL;
+
+// internal functions
+static void Build();
+static int LastLine(const FileData* file_data);
+static int BaseRowLength(int row);
+static inline int Physical(int pos);
+static inline int Logical(int phys);
+static inline int TextLength();
+static inline int RowStart(int row);
+static void MoveGap(int pos);
+static int AddRows(int row);
+static int RegionRows(int from, int paragraphs, int* lengths);
+static int Rewrap(int from, int start, int old_rows, const int* lengths, int count);
+static int Fits();
+static void Trim(int keep);
+static int RowAt(int pos);
+static int ParagraphEnd(int row);
+static void Reindex(int row, int start, int end);
+static int BlockPos(int row, int col);
+static void CursorAt(int pos, int* row, int* col);
+static int Splice(int pos, int remove, const char* insert, int amount, DocumentChange* change);
+static int SpliceStep(int pos, int remove, const char* insert, int amount, DocumentChange* change);
+static int ParagraphStart(int row);
+static void Swap(int pos, int first, int second, DocumentChange* change);
+static int Edit(int from, int pos, const char* insert, int amount, DocumentChange* change);
+static int ApplyStep(const UndoStep* step, int undo, DocumentChange* change, int* row, int* col);
+static int ApplyMove(const UndoStep* step, int undo, DocumentChange* change, int* row, int* col);
+
+// ----------------------------------------------------
+// functions exposed in the header file
+// ----------------------------------------------------
+
+/*
+    ---
+    Loads the document from a file
+    ---
+    file is only remembered, so it has to stay the same until it's loaded again
+    (text is built from it when it's first needed)
+*/
+void DocumentLoad(const FileData* file_data) {
+    UndoClear();
+    base = file_data;
+}
+
+// puts the document into a file, only lines that changed are updated and marked as dirty
+void DocumentStore(FileData* file_data) {
+    // nothing changed since it was loaded
+    if (base == file_data)
+        return;
+    Build();
+    char line[LINE_SIZE];
+    for (int i = 0; i < AMOUNT_OF_LINES; i++) {
+        const int len = DocumentRow(i, line);
+        memset(&line[len], 0xFF, LINE_SIZE - len);
+        if (len != file_data->line_lengths[i] || memcmp(line, file_data->data[i], LINE_SIZE) != 0) {
+            memcpy(file_data->data[i], line, LINE_SIZE);
+            file_data->line_lengths[i] = len;
+            MarkLinesDirty(file_data, i, i);
+        }
+    }
+}
+
+// copies characters of a row into 'buf' (up to LINE_SIZE), returns their amount
+int DocumentRow(int row, char* buf) {
+    if (base != NULL) {
+        const int len = BaseRowLength(row);
+        for (int i = 0; i < len; i++)
+            buf[i] = base->data[row][i] < ' ' ? ' ' : base->data[row][i];
+        return len;
+    }
+    if (row >= rows)
+        return 0;
+    const int len = row_lengths[row];
+    const int phys = row_starts[row];
+    if (phys >= gap_end) {
+        memcpy(buf, &text[phys], len);
+    } else {
+        // row can be cut by the gap
+        const int before = gap_start - phys < len ? gap_start - phys : len;
+        memcpy(buf, &text[phys], before);
+        memcpy(&buf[before], &text[gap_end], len - before);
+    }
+    return len;
+}
+
+int DocumentRowLength(int row) {
+    if (base != NULL)
+        return BaseRowLength(row);
+    return row < rows ? row_lengths[row] : 0;
+}
+
+/*
+    ---
+    Inserts a character (or a line break) at a position
+    ---
+    column can be LINE_SIZE in a full row, which is the start of the next one
+    'change' gets the rows that changed
+    returns -1 if the text wouldn't fit in a file and 0 on success
+*/
+int DocumentInsert(int row, int col, char chr, DocumentChange* change) {
+    Build();
+    if (AddRows(row) < 0 || gap_start == gap_end)
+        return -1;
+    const int pos = RowStart(row) + col;
+    if (Edit(row, pos, &chr, 1, change) < 0)
+        return -1;
+    UndoRecordInsert(pos, chr);
+    return 0;
+}
+
+// overwrites a character, at the end of a paragraph it's inserted instead
+int DocumentReplace(int row, int col, char chr, DocumentChange* change) {
+    Build();
+    if (AddRows(row) < 0)
+        return -1;
+    const int pos = RowStart(row) + col;
+    const int phys = Physical(pos);
+    if (text[phys] == BREAK)
+        return DocumentInsert(row, col, chr, change);
+
+    UndoRecordReplace(pos, text[phys], chr);
+    text[phys] = chr;
+    *change = (DocumentChange){ col == LINE_SIZE ? row+1 : row, 1, 1 };
+    return 0;
+}
+
+/*
+    ---
+    Removes a character at a position
+    ---
+    removing the line break at the end of a paragraph joins it with the next one,
+    parameter 'backwards' tells the cursor was after the character (for the undo history)
+    returns -1 if there's nothing to remove and 0 on success
+*/
+int DocumentDelete(int row, int col, int backwards, DocumentChange* change) {
+    Build();
+    if (row >= rows)
+        return -1;
+    const int pos = RowStart(row) + col;
+    // last line break can't go, rows after it are empty anyway
+    if (pos >= TextLength()-1)
+        return -1;
+    const char chr = text[Physical(pos)];
+    if (Edit(row, pos, NULL, 1, change) < 0)
+        return -1;
+    UndoRecordDelete(pos, chr, backwards);
+    return 0;
+}
+
+/*
+    ---
+    Takes back the newest step of the undo history
+    ---
+    'row' and 'col' get the position the cursor should go to
+    returns -1 if there's nothing to undo and 0 on success
+*/
+int DocumentUndo(DocumentChange* change, int* row, int* col) {
+    UndoStep step;
+    if (!UndoPrevious(&step))
+        return -1;
+    return ApplyStep(&step, 1, change, row, col);
+}
+
+// does the newest undone step again, works like DocumentUndo()
+int DocumentRedo(DocumentChange* change, int* row, int* col) {
+    UndoStep step;
+    if (!UndoNext(&step))
+        return -1;
+    return ApplyStep(&step, 0, change, row, col);
+}
+
+/*
+    ---
+    Copies characters from ('row', 'col') up to ('to_row', 'to_col') into 'buf'
+    ---
+    positions can come in any order, line breaks between them are copied too,
+    position past the text is its end (the last line break isn't part of any block)
+    returns amount of copied characters or -1 if there are more than 'size'
+*/
+int DocumentCopy(int row, int col, int to_row, int to_col, char* buf, int size) {
+    Build();
+    int pos = BlockPos(row, col);
+    int end = BlockPos(to_row, to_col);
+    if (end < pos) {
+        const int swap = pos;
+        pos = end;
+        end = swap;
+    }
+    if (end - pos > size)
+        return -1;
+    for (int i = pos; i < end; i++)
+        buf[i - pos] = text[Physical(i)];
+    return end - pos;
+}
+
+/*
+    ---
+    Puts a block of characters in place of the ones from ('row', 'col') up to ('to_row', 'to_col')
+    ---
+    block can hold line breaks and it can be empty (characters are only removed),
+    it's done as one edit, so changed paragraphs are cut into rows once
+    and the undo history gets a step for the removed characters and one for the block
+    'end_row' and 'end_col' get the position after the block
+    returns -1 if the text wouldn't fit in a file (or there's nothing to do) and 0 on success
+*/
+int DocumentSplice(int row, int col, int to_row, int to_col, const char* block, int len, DocumentChange* change, int* end_row, int* end_col) {
+    Build();
+    if (to_row < row || (to_row == row && to_col < col)) {
+        const int swap_row = row;
+        const int swap_col = col;
+        row = to_row;
+        col = to_col;
+        to_row = swap_row;
+        to_col = swap_col;
+    }
+    // block past the end of the text goes after empty paragraphs, like typing there
+    if (len > 0 && AddRows(row) < 0)
+        return -1;
+    const int pos = BlockPos(row, col);
+    const int end = BlockPos(to_row, to_col) > pos ? BlockPos(to_row, to_col) : pos;
+    if ((end == pos && len == 0) || SpliceStep(pos, end - pos, block, len, change) < 0)
+        return -1;
+    CursorAt(pos + len, end_row, end_col);
+    return 0;
+}
+
+/*
+    ---
+    Removes the line (paragraph) holding 'row'
+    ---
+    line after it takes its place, the last line is joined to the previous one instead
+    as the last line break has to stay, only lines of the paragraph are logged as removed
+    'new_row' and 'new_col' get the cursor position
+    returns -1 if there's nothing to remove and 0 on success
+*/
+int DocumentDeleteLine(int row, DocumentChange* change, int* new_row, int* new_col) {
+    Build();
+    if (row >= rows)
+        return -1;
+    const int first = ParagraphStart(row);
+    const int end = ParagraphEnd(row);
+    const int start = RowStart(first);
+    const int line_break = RowStart(end) + row_lengths[end];
+    if (line_break < TextLength()-1) {
+        SpliceStep(start, line_break+1 - start, NULL, 0, change);
+    } else if (start > 0) {
+        SpliceStep(start-1, line_break+1 - start, NULL, 0, change);
+    } else {
+        // only line of the text is emptied
+        if (line_break == 0)
+            return -1;
+        SpliceStep(0, line_break, NULL, 0, change);
+        *new_row = 0;
+        *new_col = 0;
+        return 0;
+    }
+    *change = (DocumentChange){ first, end - first + 1, 0 };
+    *new_row = first < rows ? first : rows-1;
+    *new_col = 0;
+    return 0;
+}
+
+/*
+    ---
+    Puts a copy of the line (paragraph) holding 'row' after it
+    ---
+    copy goes in before the line, so the characters it's made of don't have to be kept anywhere else
+    and rows of the line only move, cursor stays at the same place in the lower copy
+    returns -1 if the copy wouldn't fit in a file and 0 on success
+*/
+int DocumentDuplicateLine(int row, int col, DocumentChange* change, int* new_row, int* new_col) {
+    Build();
+    if (row >= rows)
+        return -1;
+    const int first = ParagraphStart(row);
+    const int end = ParagraphEnd(row);
+    const int start = RowStart(first);
+    const int len = RowStart(end) + row_lengths[end]+1 - start;
+    MoveGap(start);
+    if (SpliceStep(start, 0, &text[gap_end], len, change) < 0)
+        return -1;
+    *change = (DocumentChange){ first, 0, end - first + 1 };
+    *new_row = row + end - first + 1;
+    *new_col = col;
+    return 0;
+}
+
+/*
+    ---
+    Swaps the line (paragraph) holding 'row' with the previous one if 'up' is set, or with the next one
+    ---
+    cursor goes along with the line, only rows of both lines change
+    returns -1 if there's no line to swap with and 0 on success
+*/
+int DocumentMoveLine(int row, int col, int up, DocumentChange* change, int* new_row, int* new_col) {
+    Build();
+    if (row >= rows)
+        return -1;
+    const int first = ParagraphStart(row);
+    const int end = ParagraphEnd(row);
+    const int start = RowStart(first);
+    const int len = RowStart(end) + row_lengths[end]+1 - start;
+    const int offset = RowStart(row) + col - start;
+    int pos;
+    if (up) {
+        if (first == 0)
+            return -1;
+        const int other = RowStart(ParagraphStart(first-1));
+        Swap(other, start - other, len, change);
+        UndoRecordMove(other, start - other, len);
+        pos = other + offset;
+    } else {
+        // trailing empty rows of a full last line belong to it
+        if (end+1 >= rows)
+            return -1;
+        const int other_end = ParagraphEnd(end+1);
+        const int other_len = RowStart(other_end) + row_lengths[other_end]+1 - (start + len);
+        Swap(start, len, other_len, change);
+        UndoRecordMove(start, len, other_len);
+        pos = start + other_len + offset;
+    }
+    CursorAt(pos, new_row, new_col);
+    return 0;
+}
+
+/*
+    ---
+    Finds a pattern in the text
+    ---
+    looks for the first occurrence starting at ('row', 'col') or after it,
+    or for the last one starting before it if 'backwards' is set (row after the text means its end)
+    occurrences can go on in the next row when a full row continues there, but not past a line break
+    text is searched in one piece, so the gap goes to its end first
+    returns -1 if there's none and 0 on success, 'found_row' and 'found_col' get where it starts
+*/
+int DocumentFind(const char* pattern, int len, int row, int col, int backwards, int* found_row, int* found_col) {
+    Build();
+    const int length = TextLength();
+    int start = row < rows ? RowStart(row) + col : length;
+    if (start > length)
+        start = length;
+    MoveGap(length);
+
+    int pos;
+    if (backwards) {
+        // occurrences starting before 'start' end before this
+        const int end = start + len-1 < length ? start + len-1 : length;
+        pos = SearchBackward(text, end, pattern, len);
+    } else {
+        pos = SearchForward(&text[start], length - start, pattern, len);
+        if (pos >= 0)
+            pos += start;
+    }
+    if (pos < 0)
+        return -1;
+    *found_row = RowAt(pos);
+    *found_col = pos - RowStart(*found_row);
+    return 0;
+}
+
+/*
+    ---
+    Tells if a file holds a pattern, without loading it into the document
+    ---
+    lines are joined into text the same way the document builds it, in place in the file's own data
+    (text is never longer than the lines it's made of), so the file can't be used after that
+    full line that ends the file has no line break after it, a pattern can't end with one anyway
+    returns 1 if the pattern is there and 0 otherwise
+*/
+int DocumentFileHolds(FileData* file_data, const char* pattern, int len) {
+    char* joined = &file_data->data[0][0];
+    const int last = LastLine(file_data);
+    int length = 0;
+    for (int i = 0; i <= last; i++) {
+        int line_len = file_data->line_lengths[i];
+        if (line_len < 0 || line_len > LINE_SIZE)
+            line_len = 0;
+        for (int j = 0; j < line_len; j++) {
+            const char chr = file_data->data[i][j];
+            joined[length++] = chr < ' ' ? ' ' : chr;
+        }
+        if (line_len < LINE_SIZE)
+            joined[length++] = BREAK;
+    }
+    return SearchForward(joined, length, pattern, len) >= 0;
+}
+
+/*
+    ---
+    Replaces every occurrence of a pattern in one pass through the text
+    ---
+    occurrences are taken from the start of the text and don't overlap, neither text can hold a line break
+    paragraphs holding them are found in the row index first to see if the result fits in a file,
+    then text from the first occurrence on is moved to the end of the buffer and written back with the
+    replacements, only those paragraphs are cut into rows again and rows after them are moved
+    undo history can't hold such step, so it's dropped
+    returns amount of replaced occurrences or -1 if the result wouldn't fit in a file
+*/
+int DocumentReplaceAll(const char* pattern, int len, const char* with, int with_len, DocumentChange* change) {
+    Build();
+    *change = (DocumentChange){ 0, 0, 0 };
+    if (len <= 0 || memchr(pattern, BREAK, len) != NULL || memchr(with, BREAK, with_len) != NULL)
+        return -1;
+    const int length = TextLength();
+    MoveGap(length);
+
+    int next = SearchForward(text, length, pattern, len);
+    if (next < 0)
+        return 0;
+    const int from = RowAt(next);
+    const int start = RowStart(from);
+    int count = 0;
+    int last;
+    int added_rows = 0;
+    int end;
+    int new_length;
+    do {
+        // paragraph holding the occurrence, its length changes by every occurrence in it
+        int first = RowAt(next);
+        while (first > 0 && row_lengths[first-1] == LINE_SIZE)
+            first--;
+        end = ParagraphEnd(first);
+        const int line_break = RowStart(end) + row_lengths[end];
+        new_length = (end - first) * LINE_SIZE + row_lengths[end];
+        do {
+            count++;
+            last = next;
+            new_length += with_len - len;
+            const int pos = next + len;
+            next = SearchForward(&text[pos], length - pos, pattern, len);
+            if (next >= 0)
+                next += pos;
+        } while (next >= 0 && next < line_break);
+        added_rows += new_length / LINE_SIZE + 1 - (end - first + 1);
+    } while (next >= 0);
+
+    // full last row is followed by the row with its line break
+    const int new_rows = rows + added_rows;
+    const int full_last = end == rows-1
+        ? new_length > 0 && new_length % LINE_SIZE == 0
+        : row_lengths[rows-1] == 0 && row_lengths[rows-2] == LINE_SIZE;
+    const int added = count * (with_len - len);
+    if ((new_rows > AMOUNT_OF_LINES && !(new_rows == AMOUNT_OF_LINES+1 && full_last)) || length + added > TEXT_SIZE)
+        return -1;
+
+    // text from the row of the first occurrence on goes to the end, the new one is written before it
+    const int region_end = RowStart(end) + row_lengths[end] + added;
+    const int gap = TEXT_SIZE - length;
+    MoveGap(RowStart(from));
+    int in = gap_end;
+    int out = gap_start;
+    for (int i = 0; i < count; i++) {
+        // occurrences are already known to end with the last one
+        next = SearchForward(&text[in], last + len + gap - in, pattern, len);
+        memmove(&text[out], &text[in], next);
+        out += next;
+        in += next;
+        memcpy(&text[out], with, with_len);
+        out += with_len;
+        in += len;
+    }
+    memmove(&text[out], &text[in], TEXT_SIZE - in);
+    gap_start = length + added;
+    gap_end = TEXT_SIZE;
+
+    // rows after the changed paragraphs only moved in the text
+    const int region_rows = end - from + 1 + added_rows;
+    const int moved = rows - end - 1;
+    memmove(&row_starts[from + region_rows], &row_starts[end + 1], moved * sizeof(row_starts[0]));
+    memmove(&row_lengths[from + region_rows], &row_lengths[end + 1], moved * sizeof(row_lengths[0]));
+    for (int i = from + region_rows; i < new_rows; i++)
+        row_starts[i] += added - gap;
+    Reindex(from, start, region_end + 1);
+    rows = new_rows;
+
+    UndoClear();
+    *change = (DocumentChange){ from, end - from + 1, region_rows };
+    return count;
+}
+
+// ----------------------------------------------------
+// internal functions
+// ----------------------------------------------------
+
+/*
+    ---
+    Builds the text from the file the document was loaded from
+    ---
+    empty lines at the end of the file are left out, characters the keyboard can't type become spaces
+*/
+static void Build() {
+    if (base == NULL)
+        return;
+    gap_start = 0;
+    gap_end = TEXT_SIZE;
+    rows = 0;
+
+    const int last = LastLine(base);
+    for (int i = 0; i <= last; i++) {
+        int len = base->line_lengths[i];
+        if (len < 0 || len > LINE_SIZE)
+            len = 0;
+        row_starts[rows] = gap_start;
+        row_lengths[rows++] = len;
+        for (int j = 0; j < len; j++) {
+            const char chr = base->data[i][j];
+            text[gap_start++] = chr < ' ' ? ' ' : chr;
+        }
+        if (len < LINE_SIZE)
+            text[gap_start++] = BREAK;
+    }
+    // full last line still needs a line break, it goes into a row past the end of the file
+    if (rows > 0 && row_lengths[rows-1] == LINE_SIZE) {
+        row_starts[rows] = gap_start;
+        row_lengths[rows++] = 0;
+        text[gap_start++] = BREAK;
+    }
+    base = NULL;
+}
+
+// last line of a file that goes into the text, empty line after a full one still ends its paragraph
+static int LastLine(const FileData* file_data) {
+    int last = AMOUNT_OF_LINES-1;
+    while (last >= 0 && file_data->line_lengths[last] == 0
+        && (last == 0 || file_data->line_lengths[last-1] < LINE_SIZE))
+        last--;
+    return last;
+}
+
+// length of a row of the file the document was loaded from, rows are its lines
+static int BaseRowLength(int row) {
+    if (row >= AMOUNT_OF_LINES)
+        return 0;
+    const int len = base->line_lengths[row];
+    return len < 0 || len > LINE_SIZE ? 0 : len;
+}
+
+static inline int Physical(int pos) {
+    return pos < gap_start ? pos : pos + gap_end - gap_start;
+}
+
+static inline int Logical(int phys) {
+    return phys < gap_start ? phys : phys - (gap_end - gap_start);
+}
+
+static inline int TextLength() {
+    return TEXT_SIZE - (gap_end - gap_start);
+}
+
+static inline int RowStart(int row) {
+    return Logical(row_starts[row]);
+}
+
+/*
+    ---
+    Moves the gap to a position of the text
+    ---
+    rows that start in the moved characters get their new place
+*/
+static void MoveGap(int pos) {
+    const int gap = gap_end - gap_start;
+    if (pos < gap_start) {
+        const int amount = gap_start - pos;
+        memmove(&text[gap_end - amount], &text[pos], amount);
+        for (int i = 0; i < rows; i++)
+            if (row_starts[i] >= pos && row_starts[i] < gap_start)
+                row_starts[i] += gap;
+        gap_start -= amount;
+        gap_end -= amount;
+    } else if (pos > gap_start) {
+        const int amount = pos - gap_start;
+        memmove(&text[gap_start], &text[gap_end], amount);
+        for (int i = 0; i < rows; i++)
+            if (row_starts[i] >= gap_end && row_starts[i] < gap_end + amount)
+                row_starts[i] -= gap;
+        gap_start += amount;
+        gap_end += amount;
+    }
+}
+
+// adds empty paragraphs at the end until 'row' exists, returns -1 if it's outside of a file
+static int AddRows(int row) {
+    if (row >= AMOUNT_OF_LINES)
+        return -1;
+    if (row < rows)
+        return 0;
+    MoveGap(TextLength());
+    while (rows <= row) {
+        row_starts[rows] = gap_start;
+        row_lengths[rows++] = 0;
+        text[gap_start++] = BREAK;
+    }
+    return 0;
+}
+
+// counts characters of paragraphs from row 'from' on, returns the amount of rows they take
+static int RegionRows(int from, int paragraphs, int* lengths) {
+    int row = from;
+    for (int i = 0; i < paragraphs; i++) {
+        lengths[i] = 0;
+        while (row_lengths[row] == LINE_SIZE)
+            lengths[i] += row_lengths[row++];
+        lengths[i] += row_lengths[row++];
+    }
+    return row - from;
+}
+
+/*
+    ---
+    Cuts paragraphs into rows again
+    ---
+    'start' is the text position of row 'from', 'old_rows' the amount of rows the paragraphs took before
+    and 'lengths' their new amounts of characters, rows after them only move in the index
+    returns the amount of rows they take now
+*/
+static int Rewrap(int from, int start, int old_rows, const int* lengths, int count) {
+    int new_rows = 0;
+    for (int i = 0; i < count; i++)
+        new_rows += lengths[i] / LINE_SIZE + 1;
+    const int moved = rows - from - old_rows;
+    memmove(&row_starts[from + new_rows], &row_starts[from + old_rows], moved * sizeof(row_starts[0]));
+    memmove(&row_lengths[from + new_rows], &row_lengths[from + old_rows], moved * sizeof(row_lengths[0]));
+    rows += new_rows - old_rows;
+
+    int row = from;
+    for (int i = 0; i < count; i++) {
+        int left = lengths[i];
+        int len;
+        do {
+            len = left < LINE_SIZE ? left : LINE_SIZE;
+            row_starts[row] = Physical(start);
+            row_lengths[row++] = len;
+            start += len;
+            left -= len;
+        } while (len == LINE_SIZE);
+        // line break
+        start++;
+    }
+    return new_rows;
+}
+
+// checks if the rows fit in a file, full last line can be followed by the row with its line break
+static int Fits() {
+    return rows <= AMOUNT_OF_LINES
+        || (rows == AMOUNT_OF_LINES+1 && row_lengths[AMOUNT_OF_LINES] == 0 && row_lengths[AMOUNT_OF_LINES-1] == LINE_SIZE);
+}
+
+// drops empty paragraphs at the end (after row 'keep') until the rows fit
+static void Trim(int keep) {
+    while (!Fits() && rows-1 >= keep && row_lengths[rows-1] == 0 && row_lengths[rows-2] < LINE_SIZE) {
+        MoveGap(TextLength()-1);
+        gap_end++;
+        rows--;
+    }
+}
+
+// finds the row holding a text position, position at the end of a full row is the start of the next one
+static int RowAt(int pos) {
+    int low = 0;
+    int high = rows-1;
+    while (low < high) {
+        const int middle = (low + high + 1) / 2;
+        if (RowStart(middle) <= pos)
+            low = middle;
+        else
+            high = middle-1;
+    }
+    return low;
+}
+
+// returns the first row of the paragraph holding 'row'
+static int ParagraphStart(int row) {
+    while (row > 0 && row_lengths[row-1] == LINE_SIZE)
+        row--;
+    return row;
+}
+
+// returns the last row of the paragraph holding 'row'
+static int ParagraphEnd(int row) {
+    while (row_lengths[row] == LINE_SIZE)
+        row++;
+    return row;
+}
+
+// cuts paragraphs from text position 'start' up to 'end' into rows, starting with 'row' (gap has to be after them)
+static void Reindex(int row, int start, int end) {
+    while (start < end) {
+        int left = (const char*)memchr(&text[start], BREAK, end - start) - &text[start];
+        int len;
+        do {
+            len = left < LINE_SIZE ? left : LINE_SIZE;
+            row_starts[row] = start;
+            row_lengths[row++] = len;
+            start += len;
+            left -= len;
+        } while (len == LINE_SIZE);
+        // line break
+        start++;
+    }
+}
+
+// text position of a row and column, clamped to the last line break
+static int BlockPos(int row, int col) {
+    const int last = TextLength() > 0 ? TextLength()-1 : 0;
+    if (row >= rows)
+        return last;
+    const int pos = RowStart(row) + col;
+    return pos < last ? pos : last;
+}
+
+// finds the row and column of a text position, position past the last line of a file is the end of the line before it
+static void CursorAt(int pos, int* row, int* col) {
+    *row = RowAt(pos);
+    *col = pos - RowStart(*row);
+    if (*row >= AMOUNT_OF_LINES) {
+        *row = AMOUNT_OF_LINES-1;
+        *col = LINE_SIZE;
+    }
+}
+
+/*
+    ---
+    Removes 'remove' characters from 'pos' and inserts 'amount' characters from 'insert' there
+    ---
+    both can hold line breaks, paragraphs from the one holding 'pos' to the one the removed characters
+    end in are counted first to see if the result fits in a file, then they're cut into rows again once
+    returns -1 if it wouldn't fit and 0 on success
+*/
+static int Splice(int pos, int remove, const char* insert, int amount, DocumentChange* change) {
+    if (amount - remove > gap_end - gap_start)
+        return -1;
+    const int from = RowAt(pos);
+    const int start = RowStart(from);
+    const int end = ParagraphEnd(RowAt(pos + remove));
+    const int line_break = RowStart(end) + row_lengths[end];
+
+    // paragraphs of the inserted characters, the first one continues the row before them
+    // and the last one goes on with what's left of the paragraph after the removed characters
+    int new_rows = 0;
+    int paragraph = pos - start;
+    for (int i = 0; i < amount; i++) {
+        if (insert[i] == BREAK) {
+            new_rows += paragraph / LINE_SIZE + 1;
+            paragraph = 0;
+        } else {
+            paragraph++;
+        }
+    }
+    paragraph += line_break - pos - remove;
+    new_rows += paragraph / LINE_SIZE + 1;
+
+    // full last row is followed by the row with its line break
+    const int old_rows = end - from + 1;
+    const int total = rows - old_rows + new_rows;
+    const int full_last = end == rows-1
+        ? paragraph > 0 && paragraph % LINE_SIZE == 0
+        : row_lengths[rows-1] == 0 && row_lengths[rows-2] == LINE_SIZE;
+    if (total > AMOUNT_OF_LINES && !(total == AMOUNT_OF_LINES+1 && full_last))
+        return -1;
+
+    MoveGap(pos);
+    gap_end += remove;
+    memcpy(&text[gap_start], insert, amount);
+    gap_start += amount;
+    // changed paragraphs go before the gap, so they can be cut into rows in one piece
+    const int new_break = line_break - remove + amount;
+    MoveGap(new_break + 1);
+
+    const int moved = rows - end - 1;
+    memmove(&row_starts[from + new_rows], &row_starts[end + 1], moved * sizeof(row_starts[0]));
+    memmove(&row_lengths[from + new_rows], &row_lengths[end + 1], moved * sizeof(row_lengths[0]));
+    Reindex(from, start, new_break + 1);
+    rows = total;
+    *change = (DocumentChange){ from, old_rows, new_rows };
+    return 0;
+}
+
+/*
+    ---
+    Splices text like Splice() and records it in the undo history
+    ---
+    removed characters are a step and inserted ones another one
+*/
+static int SpliceStep(int pos, int remove, const char* insert, int amount, DocumentChange* change) {
+    // longer block can't be undone anyway
+    static char removed[UNDO_MAX_RUN];
+    for (int i = 0; i < remove && i < UNDO_MAX_RUN; i++)
+        removed[i] = text[Physical(pos + i)];
+    if (Splice(pos, remove, insert, amount, change) < 0)
+        return -1;
+    if (remove > 0)
+        UndoRecordBlock(StepDelete, pos, removed, remove);
+    // inserted characters are before the gap now (they may have come from the text itself)
+    if (amount > 0)
+        UndoRecordBlock(StepInsert, pos, &text[pos], amount);
+    return 0;
+}
+
+/*
+    ---
+    Swaps 'first' characters at 'pos' with 'second' characters after them
+    ---
+    both have to be whole paragraphs with their line breaks, so amount of rows doesn't change
+    characters are swapped in place by reversing both parts and then all of them
+*/
+static void Swap(int pos, int first, int second, DocumentChange* change) {
+    const int from = RowAt(pos);
+    const int end = ParagraphEnd(RowAt(pos + first));
+    MoveGap(pos + first + second);
+    const int parts[3][2] = { { pos, first }, { pos + first, second }, { pos, first + second } };
+    for (int i = 0; i < 3; i++) {
+        for (int left = parts[i][0], right = parts[i][0] + parts[i][1]-1; left < right; left++, right--) {
+            const char chr = text[left];
+            text[left] = text[right];
+            text[right] = chr;
+        }
+    }
+    Reindex(from, pos, pos + first + second);
+    *change = (DocumentChange){ from, end - from + 1, end - from + 1 };
+}
+
+/*
+    ---
+    Inserts or removes characters and cuts changed paragraphs into rows
+    ---
+    'from' is the row holding text position 'pos', 'insert' has 'amount' characters to insert
+    or it's NULL to remove 'amount' characters from 'pos'
+    a line break can only be inserted or removed on its own
+    edit is taken back if the rows don't fit in a file anymore
+    returns -1 in that case and 0 on success
+*/
+static int Edit(int from, int pos, const char* insert, int amount, DocumentChange* change) {
+    static char removed[UNDO_MAX_RUN];
+    if (insert != NULL && gap_end - gap_start < amount)
+        return -1;
+    const int start = RowStart(from);
+    const int offset = pos - start;
+    MoveGap(pos);
+    if (insert == NULL)
+        for (int i = 0; i < amount; i++)
+            removed[i] = text[gap_end + i];
+
+    // paragraph holding the position and the next one if its line break goes away
+    int lengths[2];
+    const int joined = insert == NULL && removed[0] == BREAK;
+    const int old_rows = RegionRows(from, 1 + joined, lengths);
+    int new_lengths[2] = { lengths[0] };
+    int count = 1;
+    if (insert != NULL && insert[0] == BREAK) {
+        new_lengths[0] = offset;
+        new_lengths[1] = lengths[0] - offset;
+        count = 2;
+    } else if (insert != NULL) {
+        new_lengths[0] += amount;
+    } else if (joined) {
+        new_lengths[0] += lengths[1];
+    } else {
+        new_lengths[0] -= amount;
+    }
+
+    if (insert != NULL) {
+        memcpy(&text[gap_start], insert, amount);
+        gap_start += amount;
+    } else {
+        gap_end += amount;
+    }
+    const int new_rows = Rewrap(from, start, old_rows, new_lengths, count);
+    Trim(from + new_rows);
+
+    if (!Fits()) {
+        if (insert != NULL) {
+            MoveGap(pos + amount);
+            gap_start -= amount;
+        } else {
+            MoveGap(pos);
+            memcpy(&text[gap_start], removed, amount);
+            gap_start += amount;
+        }
+        Rewrap(from, start, new_rows, lengths, 1 + joined);
+        return -1;
+    }
+    *change = (DocumentChange){ from, old_rows, new_rows };
+    return 0;
+}
+
+/*
+    ---
+    Applies a step of the undo history, backwards when 'undo' is set
+    ---
+    text it works on has to be where the history left it, otherwise the history is dropped
+    'row' and 'col' get the cursor position after the step
+    returns -1 if the step couldn't be applied and 0 on success
+*/
+static int ApplyStep(const UndoStep* step, int undo, DocumentChange* change, int* row, int* col) {
+    const int pos = step->pos;
+    const int amount = step->amount;
+    if (step->type == StepMove)
+        return ApplyMove(step, undo, change, row, col);
+    const int removing = step->type != StepReplace && (step->type == StepInsert) == undo;
+    const int inserting = step->type != StepReplace && !removing;
+    // empty paragraphs at the end may have been dropped to make room, insert brings them back
+    if (inserting && pos >= TextLength())
+        AddRows(rows-1 + pos - TextLength() + 1);
+    int valid = inserting ? pos < TextLength() : pos + amount < TextLength();
+    // characters the step takes away have to be the ones it recorded
+    const char* current = step->type == StepReplace && !undo ? step->replaced : step->chars;
+    for (int i = 0; valid && !inserting && i < amount; i++)
+        valid = text[Physical(pos + i)] == current[i];
+
+    int result = -1;
+    int cursor = pos + amount;
+    if (removing && amount == 1 && step->chars[0] == BREAK && pos >= TextLength()-1) {
+        // empty paragraph at the end was already dropped (or it's the last line break), nothing shows it
+        *change = (DocumentChange){ 0, 0, 0 };
+        cursor = TextLength()-1;
+        result = 0;
+    } else if (valid && step->type == StepReplace) {
+        for (int i = 0; i < amount; i++)
+            text[Physical(pos + i)] = undo ? step->replaced[i] : step->chars[i];
+        const int first = RowAt(pos);
+        const int count = RowAt(pos + amount-1) - first + 1;
+        *change = (DocumentChange){ first, count, count };
+        result = 0;
+    } else if (valid && amount > 1 && memchr(step->chars, BREAK, amount) != NULL) {
+        // block with line breaks
+        result = removing ? Splice(pos, amount, NULL, 0, change) : Splice(pos, 0, step->chars, amount, change);
+        if (removing)
+            cursor = pos;
+    } else if (valid && removing) {
+        result = Edit(RowAt(pos), pos, NULL, amount, change);
+        cursor = pos;
+    } else if (valid) {
+        result = Edit(RowAt(pos), pos, step->chars, amount, change);
+    }
+    if (result < 0) {
+        UndoClear();
+        return -1;
+    }
+    CursorAt(cursor, row, col);
+    return 0;
+}
+
+/*
+    ---
+    Swaps lines back (or again) for a step of the undo history
+    ---
+    line that was moved is at 'pos' before the step, the one it was swapped with is after it
+    returns -1 if lines aren't where the step left them (history is dropped then) and 0 on success
+*/
+static int ApplyMove(const UndoStep* step, int undo, DocumentChange* change, int* row, int* col) {
+    const int moved = (uint8_t)step->chars[0] + ((uint8_t)step->chars[1] << 8);
+    const int other = (uint8_t)step->chars[2] + ((uint8_t)step->chars[3] << 8);
+    const int first = undo ? other : moved;
+    const int pos = step->pos;
+    if (pos + moved + other > TextLength() || text[Physical(pos + first-1)] != BREAK
+        || text[Physical(pos + moved + other-1)] != BREAK || (pos > 0 && text[Physical(pos-1)] != BREAK)) {
+        UndoClear();
+        return -1;
+    }
+    Swap(pos, first, moved + other - first, change);
+    CursorAt(undo ? pos : pos + other, row, col);
+    return 0;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "files.h"
+
+// rows touched by an edit, rows after them only moved if the amount changed
+typedef struct DocumentChange {
+    int first;
+    int old_rows;
+    int new_rows;
+} DocumentChange;
+
+void DocumentLoad(const FileData* file_data);
+void DocumentStore(FileData* file_data);
+int DocumentRow(int row, char* buf);
+int DocumentRowLength(int row);
+int DocumentInsert(int row, int col, char chr, DocumentChange* change);
+int DocumentReplace(int row, int col, char chr, DocumentChange* change);
+int DocumentDelete(int row, int col, int backwards, DocumentChange* change);
+int DocumentUndo(DocumentChange* change, int* row, int* col);
+int DocumentRedo(DocumentChange* change, int* row, int* col);
+int DocumentFind(const char* pattern, int len, int row, int col, int backwards, int* found_row, int* found_col);
+int DocumentFileHolds(FileData* file_data, const char* pattern, int len);
+int DocumentCopy(int row, int col, int to_row, int to_col, char* buf, int size);
+int DocumentSplice(int row, int col, int to_row, int to_col, const char* block, int len, DocumentChange* change, int* end_row, int* end_col);
+int DocumentDeleteLine(int row, DocumentChange* change, int* new_row, int* new_col);
+int DocumentDuplicateLine(int row, int col, DocumentChange* change, int* new_row, int* new_col);
+int DocumentMoveLine(int row, int col, int up, DocumentChange* change, int* new_row, int* new_col);
+int DocumentReplaceAll(const char* pattern, int len, const char* with, int with_len, DocumentChange* change);
@@ -1,19 +1,35 @@
 #include "lcd.h"
 #include "files.h"
+#include "saver.h"
+#include "editlog.h"
+#include "cache.h"
+#include "document.h"
+#include "flash.h"
 #include "editor.h"
+#include "loop.h"
 #include <stdlib.h>
 #include <string.h>
 #include "tusb.h"
 #include "bsp/board.h"
 #include "pico/stdlib.h"
 
+// cut or copied text can be as long as a whole file
+#define CLIPBOARD_SIZE (DATA_SIZE)
+// how long a message is shown if no key is pressed
+#define STATUS_MS (1000)
+
 typedef enum CurrentMenu {
     FileSelection,
     ExistingFileOperations,
     NewFileOperations,
     FileNameSelection,
     TextEditor,
-    EditorExitPrompt
+    EditorExitPrompt,
+    TextSearch,
+    FilesSearch,
+    SearchResults,
+    TextReplace,
+    TextReplaceWith
 } CurrentMenu;
 
 typedef enum SelectedOperation {
@@ -36,15 +52,46 @@ int show_indexes = 0;
 int insert_mode = 0;
 // Stores whether keyboard was mounted on first boot
 int device_mounted = 0;
+// Stores whether keys are ignored (while booting or until work waiting for its message to be shown is done)
+int busy = 1;
+// Stores what's shown after the current message (NULL if there's none)
+LoopCallback status_done = NULL;
+
+// Stores whether text is being selected in the editor (controlled by 'shift' with keys moving the cursor)
+// and where the selection started, it ends at the cursor
+int selecting = 0;
+int selection_line, selection_col;
+// Stores text cut or copied in the editor and its length, it's kept when another file is opened
+char clipboard[CLIPBOARD_SIZE];
+int clipboard_len = 0;
 
 // Stores current name when in new file/renaming menu
 char new_name_buf[16];
 // Stores length of current name when in new file/renaming menu 
 int new_name_len = 0;
 
+// Stores text searched for in the editor or in all files (controlled by 'ctrl+f' on keyboard) and its length
+char search_buf[LINE_SIZE];
+int search_len = 0;
+// Stores where the cursor was when search started, it goes back there if the search is cancelled
+int search_origin_line, search_origin_col, search_origin_row;
+// Stores where the current occurrence starts and which line is shown above the searched text (-1 if none)
+int search_line, search_col;
+int search_shown;
+// Stores files holding the text searched for in all files, their amount and the selected one
+int search_results[AMOUNT_OF_FILES];
+int search_result_count = 0;
+int search_result = 0;
+// Stores the next file to be searched and the buffer it's loaded into
+int search_file = 0;
+FileData search_data;
+// Stores text that replaces every occurrence of the searched text (controlled by 'ctrl+h' on keyboard) and its length
+char replace_buf[LINE_SIZE];
+int replace_len = 0;
+
 // Stores all file names and their lengths 
 FilesInfo files_info;
-// Stores currently opened file's lines and their lengths 
+// Stores currently opened file as it's saved, edits go to the document (see document.c)
 FileData file_data;
 // Stores which menu the program is currently in
 CurrentMenu current_menu;
@@ -61,6 +108,11 @@ void NewFileOperationsDefaults();
 void FileRenameDefaults();
 void TextEditorDefaults();
 void EditorExitPromptDefaults();
+void TextSearchDefaults();
+void FilesSearchDefaults();
+void SearchResultsAt(int pos);
+void TextReplaceDefaults();
+void TextReplaceWithDefaults();
 
 int LineAddChar(char chr, char* line, int* len);
 void LineDelete(char* line, int* len);
@@ -70,19 +122,68 @@ void EditorAddChar(char chr);
 void EditorDelete();
 void EditorBackspace();
 void EditorEnter();
+void EditorUndo(int redo);
+void EditorCopy();
+void EditorCutSelection(int copy);
+void EditorPaste();
+void EditorDeleteLine();
+void EditorDuplicateLine();
+void EditorMoveLine(int up);
+void LogEdit(const DocumentChange* change);
+void ShowEdit(const DocumentChange* change, int line, int col, int from, int old_len);
+void ShowLines(int line, int col, int row);
+void ShowCursorMode();
+
+int FindWrapped(int line, int col, int backwards, int* found_line, int* found_col);
+void EditorFindNext(int backwards);
+void SearchAddChar(char chr);
+void SearchBackspace();
+void SearchStep(int backwards);
+void SearchShow(int found);
+void SearchFiles();
+int OpenFile();
+void EditorReplaceAll();
+
+void ShowStatus(const char* message, LoopCallback done);
+void EndStatus();
+void ShowFileSelection();
+void ShowSearchOrigin();
+void FindInFiles();
+void BootConnected();
+void BootSelectFile();
+void BootOpen();
+void EditorIdle();
 
 void PrintFileName(int pos, int row);
 void PrintDataLine(int pos, int row);
+void PrintDataLinePart(int pos, int row, int from, int old_len);
+
+int CheckSaves();
 
 // ----------------------------------------------------
 // functions exposed in the header file
 // ----------------------------------------------------
 
-// sets mounted flag to true (only needed on first boot)
+// sets mounted flag to true (only needed on first boot), boot goes on a moment after
 void ProcessMount() {
+    if (!device_mounted)
+        LoopAddTimer(100, 0, BootConnected);
     device_mounted = 1;
 }
 
+// called for every keyboard report, flash erases are held back while typing goes on
+void ProcessInput() {
+    FlashInputSeen();
+}
+
+// called for every key pressed before it's handled, a shown message is ended, returns 0 if the key is ignored
+int ProcessKeyPress() {
+    if (busy)
+        return 0;
+    EndStatus();
+    return 1;
+}
+
 // depending on current menu, redirects char input into proper functions
 void ProcessChar(char chr) {
     if (show_indexes) {
@@ -98,6 +199,16 @@ void ProcessChar(char chr) {
     case TextEditor:
         EditorAddChar(chr);
         break;
+    case TextSearch:
+        SearchAddChar(chr);
+        break;
+    case FilesSearch:
+    case TextReplace:
+        LineAddChar(chr, search_buf, &search_len);
+        break;
+    case TextReplaceWith:
+        LineAddChar(chr, replace_buf, &replace_len);
+        break;
     default:
         break;
     }
@@ -229,7 +340,7 @@ void ProcessArrowRight() {
 
     case TextEditor:
         // if cursor is before the end of the line
-        if (lcd_col < file_data.line_lengths[current_line]) {
+        if (lcd_col < DocumentRowLength(current_line)) {
             // move it forwards by 1
             SetCursor(++lcd_col, lcd_row);
         // if cursor is at the end of the line, that is not the last one
@@ -298,14 +409,31 @@ void ProcessArrowUp() {
                 PrintDataLine(current_line, TOP_ROW);
             }
             // if after changing lines cursor is after the end of current line
-            if (lcd_col > file_data.line_lengths[current_line])
+            if (lcd_col > DocumentRowLength(current_line))
                 // move it at the end of current line
-                lcd_col = file_data.line_lengths[current_line];
+                lcd_col = DocumentRowLength(current_line);
             // set final cursor postion on display
             SetCursor(lcd_col, lcd_row);
         }
         break;
 
+    case SearchResults:
+        if (search_result > 0) {
+            if (lcd_row == BOTTOM_ROW) {
+                lcd_row = TOP_ROW;
+            } else {
+                PrintFileName(search_results[search_result], BOTTOM_ROW);
+                PrintFileName(search_results[search_result-1], TOP_ROW);
+            }
+            search_result--;
+            SetCursor(0, lcd_row);
+        }
+        break;
+
+    case TextSearch:
+        SearchStep(1);
+        break;
+
     default:
         break;
     }
@@ -349,13 +477,30 @@ void ProcessArrowDown(){
             }
         }
         // if after changing lines cursor is after the end of current line
-        if (lcd_col > file_data.line_lengths[current_line])
+        if (lcd_col > DocumentRowLength(current_line))
             // move it at the end of current line
-            lcd_col = file_data.line_lengths[current_line];
+            lcd_col = DocumentRowLength(current_line);
         // set final cursor postion on display
         SetCursor(lcd_col, lcd_row);
         break;
 
+    case SearchResults:
+        if (search_result < search_result_count-1) {
+            if (lcd_row == TOP_ROW) {
+                lcd_row = BOTTOM_ROW;
+            } else {
+                PrintFileName(search_results[search_result], TOP_ROW);
+                PrintFileName(search_results[search_result+1], BOTTOM_ROW);
+            }
+            search_result++;
+            SetCursor(0, lcd_row);
+        }
+        break;
+
+    case TextSearch:
+        SearchStep(0);
+        break;
+
     default:
         break;
     }
@@ -385,6 +530,16 @@ void ProcessEscape() {
     case EditorExitPrompt:
         TextEditorDefaults();
         break;
+    case TextSearch:
+    case TextReplace:
+    case TextReplaceWith:
+        // go back to where the search started
+        ShowLines(search_origin_line, search_origin_col, search_origin_row);
+        break;
+    case FilesSearch:
+    case SearchResults:
+        FileSelectionAt(current_file);
+        break;
     default:
         break;
     }
@@ -410,18 +565,18 @@ void ProcessEnter() {
     case ExistingFileOperations:
         switch (selected_operation) {
         case FileOpen:
-            ClearDisplay();
-            Print("Opening file...");
-            sleep_ms(1000);
-
-            GetFileData(&file_data, current_file);
-            TextEditorDefaults();
+            OpenFile();
             break;
         case FileRename:
             FileRenameDefaults();
             break;
         case FileDelete:
+            // written on core1 after saves of the file, failed ones are dropped instead of coming back
             DeleteFile(&files_info, &file_data, current_file);
+            QueueFileName(&files_info, current_file);
+            QueueFileDelete(&file_data, current_file);
+            // cache keeps the empty file until it's written, so a new file in the slot doesn't open the old one
+            CachePutFile(&file_data, current_file);
             FileSelectionAt(current_file);
             break;
         case GoBack:
@@ -447,17 +602,13 @@ void ProcessEnter() {
 
     case FileNameSelection:
         if (new_name_len > 0) {
-            CreateFile(&files_info, current_file, new_name_buf, new_name_len);
-
-            CursorOff();
-            BlinkingOff();
-            ClearDisplay();
             if (selected_operation == FileCreate)
-                Print("File created");
+                CreateFile(&files_info, current_file, new_name_buf, new_name_len);
             else
-                Print("File renamed");
-            sleep_ms(1000);
-            FileSelectionAt(current_file);
+                RenameFile(&files_info, current_file, new_name_buf, new_name_len);
+            QueueFileName(&files_info, current_file);
+
+            ShowStatus(selected_operation == FileCreate ? "File created" : "File renamed", ShowFileSelection);
         }
     break;
 
@@ -468,10 +619,14 @@ void ProcessEnter() {
     case EditorExitPrompt:
         switch (selected_operation) {
             case FileSave:
-                WriteFileData(&file_data, current_file);
+                // saved on core1, if it fails the file comes back through CheckSaves()
+                DocumentStore(&file_data);
+                QueueFileSave(&file_data, current_file);
+                CachePutFile(&file_data, current_file);
                 FileSelectionAt(current_file);
                 break;
             case Discard:
+                EditLogStop();
                 FileSelectionAt(current_file);
                 break;
             case GoBack:
@@ -482,6 +637,39 @@ void ProcessEnter() {
         }
         break;
 
+    case FilesSearch:
+        if (search_len > 0)
+            SearchFiles();
+        break;
+
+    case SearchResults:
+        // open the file at the first occurrence, later ones are a F3 away
+        current_file = search_results[search_result];
+        if (OpenFile()) {
+            int line, col;
+            const DocumentChange nothing = { 0, 0, 0 };
+            if (FindWrapped(0, 0, 0, &line, &col))
+                ShowEdit(&nothing, line, col, 0, 0);
+        }
+        break;
+
+    case TextSearch:
+        // continue editing at the occurrence, it's shown in the top row
+        if (search_shown >= 0)
+            ShowLines(search_line, search_col, search_line < AMOUNT_OF_LINES-1 ? TOP_ROW : BOTTOM_ROW);
+        else
+            ShowLines(search_origin_line, search_origin_col, search_origin_row);
+        break;
+
+    case TextReplace:
+        if (search_len > 0)
+            TextReplaceWithDefaults();
+        break;
+
+    case TextReplaceWith:
+        EditorReplaceAll();
+        break;
+
     default:
         break;
     }
@@ -499,7 +687,10 @@ void ProcessDelete() {
             LineDelete(new_name_buf, &new_name_len);
             break;
         case TextEditor:
-            EditorDelete();
+            if (selecting)
+                EditorCutSelection(0);
+            else
+                EditorDelete();
             break;
         default:
             break;
@@ -518,13 +709,162 @@ void ProcessBackspace() {
             LineBackspace(new_name_buf, &new_name_len);
             break;
         case TextEditor:
-            EditorBackspace();
+            if (selecting)
+                EditorCutSelection(0);
+            else
+                EditorBackspace();
+            break;
+        case TextSearch:
+            SearchBackspace();
+            break;
+        case FilesSearch:
+        case TextReplace:
+            LineBackspace(search_buf, &search_len);
+            break;
+        case TextReplaceWith:
+            LineBackspace(replace_buf, &replace_len);
             break;
         default:
             break;
     }
 }
 
+// takes back the last edit in text editor
+void ProcessUndo() {
+    // hide indexes if they are currently shown and stop
+    if (show_indexes) {
+        ProcessTab();
+        return;
+    }
+    if (current_menu == TextEditor)
+        EditorUndo(0);
+}
+
+// does the last undone edit again in text editor
+void ProcessRedo() {
+    // hide indexes if they are currently shown and stop
+    if (show_indexes) {
+        ProcessTab();
+        return;
+    }
+    if (current_menu == TextEditor)
+        EditorUndo(1);
+}
+
+/*
+    ---
+    Starts selecting text in text editor, or stops it
+    ---
+    parameter 'extend' tells a key moving the cursor was pressed with shift,
+    selection starts at the cursor then and goes on until any other key is pressed
+*/
+void ProcessSelect(int extend) {
+    if (current_menu != TextEditor || show_indexes || extend == selecting)
+        return;
+    selecting = extend;
+    if (selecting) {
+        selection_line = current_line;
+        selection_col = lcd_col;
+    }
+    ShowCursorMode();
+}
+
+// copies selected text in text editor, it's removed too if parameter 'cut' is set
+void ProcessCopy(int cut) {
+    // hide indexes if they are currently shown and stop
+    if (show_indexes) {
+        ProcessTab();
+        return;
+    }
+    if (current_menu != TextEditor || !selecting)
+        return;
+    if (cut)
+        EditorCutSelection(1);
+    else
+        EditorCopy();
+}
+
+// puts copied text at the cursor (in place of the selected text) in text editor
+void ProcessPaste() {
+    // hide indexes if they are currently shown and stop
+    if (show_indexes) {
+        ProcessTab();
+        return;
+    }
+    if (current_menu == TextEditor)
+        EditorPaste();
+}
+
+// removes the line with the cursor in text editor
+void ProcessDeleteLine() {
+    // hide indexes if they are currently shown and stop
+    if (show_indexes) {
+        ProcessTab();
+        return;
+    }
+    if (current_menu == TextEditor)
+        EditorDeleteLine();
+}
+
+// puts a copy of the line with the cursor after it in text editor
+void ProcessDuplicateLine() {
+    // hide indexes if they are currently shown and stop
+    if (show_indexes) {
+        ProcessTab();
+        return;
+    }
+    if (current_menu == TextEditor)
+        EditorDuplicateLine();
+}
+
+// moves the line with the cursor up (or down) by one line in text editor
+void ProcessMoveLine(int up) {
+    // hide indexes if they are currently shown and stop
+    if (show_indexes) {
+        ProcessTab();
+        return;
+    }
+    if (current_menu == TextEditor)
+        EditorMoveLine(up);
+}
+
+// starts searching in text editor or in all files from file selection
+void ProcessSearch() {
+    // hide indexes if they are currently shown and stop
+    if (show_indexes) {
+        ProcessTab();
+        return;
+    }
+    if (current_menu == TextEditor)
+        TextSearchDefaults();
+    else if (current_menu == FileSelection)
+        FilesSearchDefaults();
+}
+
+// starts replacing every occurrence of a text in text editor
+void ProcessReplace() {
+    // hide indexes if they are currently shown and stop
+    if (show_indexes) {
+        ProcessTab();
+        return;
+    }
+    if (current_menu == TextEditor)
+        TextReplaceDefaults();
+}
+
+// goes to the next occurrence of the searched text (or the previous one if 'backwards' is set)
+void ProcessSearchNext(int backwards) {
+    // hide indexes if they are currently shown and stop
+    if (show_indexes) {
+        ProcessTab();
+        return;
+    }
+    if (current_menu == TextEditor)
+        EditorFindNext(backwards);
+    else if (current_menu == TextSearch)
+        SearchStep(backwards);
+}
+
 // depending on current menu, executes tab operations
 void ProcessTab() {
     switch (current_menu) {
@@ -617,24 +957,24 @@ void ProcessPageDown() {
         break;
     
     case TextEditor:
-        if ((lcd_row == BOTTOM_ROW && current_line < AMOUNT_OF_FILES-2) || 
-            (lcd_row == TOP_ROW && current_line == AMOUNT_OF_FILES-3)) {
+        if ((lcd_row == BOTTOM_ROW && current_line < AMOUNT_OF_LINES-2) || 
+            (lcd_row == TOP_ROW && current_line == AMOUNT_OF_LINES-3)) {
             current_line += 2;
             PrintDataLine(current_line-1, TOP_ROW);
             PrintDataLine(current_line, BOTTOM_ROW);
             lcd_row = BOTTOM_ROW;
-        } else if (lcd_row == TOP_ROW && current_line == AMOUNT_OF_FILES-2) {
+        } else if (lcd_row == TOP_ROW && current_line == AMOUNT_OF_LINES-2) {
             current_line++;
             PrintDataLine(current_line-1, TOP_ROW);
             PrintDataLine(current_line, BOTTOM_ROW);
             lcd_row = BOTTOM_ROW;
-        } else if (lcd_row == TOP_ROW && current_line < AMOUNT_OF_FILES-3) {
+        } else if (lcd_row == TOP_ROW && current_line < AMOUNT_OF_LINES-3) {
             current_line += 2;
             PrintDataLine(current_line, TOP_ROW);
             PrintDataLine(current_line+1, BOTTOM_ROW);
         }
-        if (lcd_col > file_data.line_lengths[current_line])
-            lcd_col = file_data.line_lengths[current_line];
+        if (lcd_col > DocumentRowLength(current_line))
+            lcd_col = DocumentRowLength(current_line);
         SetCursor(lcd_col, lcd_row);
         break;
 
@@ -682,8 +1022,8 @@ void ProcessPageUp() {
             PrintDataLine(current_line-1, TOP_ROW);
             PrintDataLine(current_line, BOTTOM_ROW);
         }
-        if (lcd_col > file_data.line_lengths[current_line])
-            lcd_col = file_data.line_lengths[current_line];
+        if (lcd_col > DocumentRowLength(current_line))
+            lcd_col = DocumentRowLength(current_line);
         SetCursor(lcd_col, lcd_row);
         break;
 
@@ -735,7 +1075,7 @@ void ProcessEnd() {
             lcd_row = BOTTOM_ROW;
             lcd_col = 0;
         } else {
-            lcd_col = file_data.line_lengths[current_line];
+            lcd_col = DocumentRowLength(current_line);
         }
         SetCursor(lcd_col, lcd_row);
         break;
@@ -745,7 +1085,13 @@ void ProcessEnd() {
     }
 }
 
-// starts the editor
+/*
+    ---
+    Starts the editor
+    ---
+    title screen waits for the keyboard, the rest of booting goes on from timers (see BootConnected())
+    so nothing sleeps, keys are ignored until the file selection (or recovered file) is shown
+*/
 void EditorInitialize() {
     // initialize onboard led
     board_init();
@@ -756,24 +1102,8 @@ void EditorInitialize() {
     Print("Pico Editor v1.0");
     SetCursor(0, BOTTOM_ROW);
     Print("Connect keyboard");
-    // Wait until keyboard is connected
-    while (!device_mounted)
-        tuh_task();
-    sleep_ms(100);
-    SetCursor(0, BOTTOM_ROW);
-    Print("Connected!      ");
-    sleep_ms(500);
-    // Show prompt "Select file"
-    ClearDisplay();
-    Print("Select file");
-    sleep_ms(1000);
-    // Get file names from flash
-    GetFilesInfo(&files_info);
-    // Enter file selection
-    FileSelectionAt(0);
     // Program loop
-    while (1)
-        tuh_task();
+    LoopRun(EditorIdle);
 }
 
 
@@ -781,6 +1111,86 @@ void EditorInitialize() {
 // internal functions
 // ----------------------------------------------------
 
+/*
+    ---
+    Shows a message for a while, then calls 'done'
+    ---
+    a key pressed before that ends the message early (see ProcessKeyPress()) and goes to what 'done' showed,
+    another message replaces this one and its 'done' isn't called
+*/
+void ShowStatus(const char* message, LoopCallback done) {
+    CursorOff();
+    BlinkingOff();
+    ClearDisplay();
+    Print(message);
+    status_done = done;
+    LoopCancelTimer(EndStatus);
+    LoopAddTimer(STATUS_MS, 0, EndStatus);
+}
+
+// ends the shown message (if there's one)
+void EndStatus() {
+    if (status_done == NULL)
+        return;
+    const LoopCallback done = status_done;
+    status_done = NULL;
+    LoopCancelTimer(EndStatus);
+    done();
+}
+
+void ShowFileSelection() {
+    FileSelectionAt(current_file);
+}
+
+// prints the editor again where the cursor was when a search or replace started
+void ShowSearchOrigin() {
+    // cursor stays in its line, unless the line got shorter than that
+    const int len = DocumentRowLength(search_origin_line);
+    ShowLines(search_origin_line, search_origin_col < len ? search_origin_col : len, search_origin_row);
+}
+
+void BootConnected() {
+    SetCursor(0, BOTTOM_ROW);
+    Print("Connected!      ");
+    LoopAddTimer(500, 0, BootSelectFile);
+}
+
+// Show prompt "Select file"
+void BootSelectFile() {
+    ClearDisplay();
+    Print("Select file");
+    LoopAddTimer(1000, 0, BootOpen);
+}
+
+void BootOpen() {
+    // Read file index and names from flash
+    InitializeFiles();
+    GetFilesInfo(&files_info);
+    // Start saving files on core1
+    SaverInitialize(&files_info);
+    CacheInitialize();
+    busy = 0;
+    // Reopen the file that was being edited before a reset, otherwise enter file selection
+    if (EditLogRecover(&file_data, &current_file)) {
+        DocumentLoad(&file_data);
+        ShowStatus("Edits recovered", TextEditorDefaults);
+    } else {
+        FileSelectionAt(0);
+    }
+}
+
+// called at the end of every loop pass
+void EditorIdle() {
+    if (busy)
+        return;
+    // write logged edits to flash while the keyboard is idle
+    EditLogTask();
+    // edited file can't be replaced, failed saves wait until it's closed (or until the message before it is gone)
+    if (current_menu != TextEditor && current_menu != EditorExitPrompt && current_menu != TextSearch
+        && current_menu != TextReplace && current_menu != TextReplaceWith && status_done == NULL)
+        CheckSaves();
+}
+
 /*
     ---
     Compares distance between current lcd_col position and provided length
@@ -849,16 +1259,19 @@ void PrintFileName(int pos, int row) {
 
 void PrintDataLine(int pos, int row) {
     SetCursor(0, row);
+    char line[LINE_SIZE];
     // length of current line
-    int len = file_data.line_lengths[pos];
+    int len = DocumentRow(pos, line);
     int empty_space_start;
     if (show_indexes) {
-        // Indexes can have max 2 digits and a sepataror between name
-        enum {index_length = 3};
+        // Indexes can have max 3 digits and a sepataror between line
+        enum {index_length = 4};
         // Print current line index
         char buf[index_length];
         Print(itoa(pos, buf, 10));
-        // Print additional space to align single digit numbers 
+        // Print additional spaces to align shorter numbers
+        if (pos < 100)
+            Write(' ');
         if (pos < 10)
             Write(' ');
         // Print the sepatator
@@ -873,17 +1286,28 @@ void PrintDataLine(int pos, int row) {
             empty_space_start = len + index_length;
         }
         // Print line
-        PrintN(file_data.data[pos], len);
+        PrintN(line, len);
     // If not showing indexes
     } else {
         empty_space_start = len;
-        PrintN(file_data.data[pos], len);
+        PrintN(line, len);
     }
     // clear space after line end
     for (int i = empty_space_start; i < MAX_CHARS; i++)
         Write(' ');
 }
 
+// prints a line from column 'from' on (without indexes), characters it had after its end ('old_len') are cleared
+void PrintDataLinePart(int pos, int row, int from, int old_len) {
+    char line[LINE_SIZE];
+    const int len = DocumentRow(pos, line);
+    SetCursor(from, row);
+    if (len > from)
+        PrintN(&line[from], len - from);
+    for (int i = len > from ? len : from; i < old_len; i++)
+        Write(' ');
+}
+
 void FileSelectionAt(int pos) {
     CursorOff();
     BlinkingOn();
@@ -994,6 +1418,7 @@ void TextEditorDefaults() {
     current_menu = TextEditor;
     show_indexes = 0;
     insert_mode = 0;
+    selecting = 0;
     PrintDataLine(0, TOP_ROW);
     PrintDataLine(1, BOTTOM_ROW);
 
@@ -1002,7 +1427,97 @@ void TextEditorDefaults() {
     SetCursor(lcd_col, lcd_row);
 }
 
+void TextSearchDefaults() {
+    CursorOn();
+    BlinkingOn();
+    current_menu = TextSearch;
+    search_origin_line = current_line;
+    search_origin_col = lcd_col;
+    search_origin_row = lcd_row;
+    search_line = current_line;
+    search_col = lcd_col;
+    search_len = 0;
+
+    // line with the cursor stays above the searched text until something is found
+    search_shown = current_line;
+    PrintDataLine(current_line, TOP_ROW);
+    SetCursor(0, BOTTOM_ROW);
+    Print("/               ");
+    lcd_col = 1;
+    lcd_row = BOTTOM_ROW;
+    SetCursor(lcd_col, lcd_row);
+}
+
+void FilesSearchDefaults() {
+    CursorOn();
+    BlinkingOff();
+    current_menu = FilesSearch;
+    show_indexes = 0;
+    memset(search_buf, 0xFF, LINE_SIZE);
+    search_len = 0;
+
+    ClearDisplay();
+    Print("Find in files:");
+    lcd_col = 0;
+    lcd_row = BOTTOM_ROW;
+    SetCursor(lcd_col, lcd_row);
+}
+
+// asks for the text to replace, the last searched one is offered
+void TextReplaceDefaults() {
+    CursorOn();
+    BlinkingOff();
+    current_menu = TextReplace;
+    search_origin_line = current_line;
+    search_origin_col = lcd_col;
+    search_origin_row = lcd_row;
+
+    ClearDisplay();
+    Print("Replace:");
+    SetCursor(0, BOTTOM_ROW);
+    PrintN(search_buf, search_len);
+    lcd_col = search_len;
+    lcd_row = BOTTOM_ROW;
+    SetCursor(lcd_col, lcd_row);
+}
+
+void TextReplaceWithDefaults() {
+    current_menu = TextReplaceWith;
+    memset(replace_buf, 0xFF, LINE_SIZE);
+    replace_len = 0;
+
+    ClearDisplay();
+    Print("With:");
+    lcd_col = 0;
+    lcd_row = BOTTOM_ROW;
+    SetCursor(lcd_col, lcd_row);
+}
+
+// shows files found by a search through all files, starting with the one at 'pos' in the results
+void SearchResultsAt(int pos) {
+    CursorOff();
+    BlinkingOn();
+    ClearDisplay();
+    current_menu = SearchResults;
+    lcd_col = 0;
+    search_result = pos;
+    // last result goes to the bottom row, like the last file in file selection
+    if (pos > 0 && pos == search_result_count-1) {
+        PrintFileName(search_results[pos-1], TOP_ROW);
+        PrintFileName(search_results[pos], BOTTOM_ROW);
+        lcd_row = BOTTOM_ROW;
+    } else {
+        PrintFileName(search_results[pos], TOP_ROW);
+        if (pos+1 < search_result_count)
+            PrintFileName(search_results[pos+1], BOTTOM_ROW);
+        lcd_row = TOP_ROW;
+    }
+    SetCursor(lcd_col, lcd_row);
+}
+
 void EditorExitPromptDefaults() {
+    // changes made so far don't wait for the editor to go idle, unless a save holds the store
+    EditLogFlush();
     CursorOff();
     BlinkingOff();
     show_indexes = 0;
@@ -1112,307 +1627,476 @@ void LineBackspace(char* line, int* len) {
 
 /*
     ---
-    Adds a character to file_data, handles multi-line operations
+    Adds a character at the cursor, handles multi-line operations
     ---
     first parameter 'chr' is the character to add
+    in insert mode the character under the cursor is replaced,
+    otherwise text after the cursor flows into the following lines (see document.c)
 */
 void EditorAddChar(char chr) {
-    // When in insert mode
-    if (insert_mode == 1) {
-        // if at line end
-        if (lcd_col == LINE_SIZE)
-            // stop if inserting after file end
-            if (current_line >= AMOUNT_OF_LINES-1)
-                return;
-            // go the the next line otherwise
-            else
-                ProcessArrowRight();
-        // Let the single line function handle it, because inserting before line end won't create more lines
-        LineAddChar(chr, file_data.data[current_line], &file_data.line_lengths[current_line]);
-    // When not in insert mode
-    } else {
-        // check if there are any non-full lines
-        int first_not_full_line = -1;
-        for (int i = current_line; i < AMOUNT_OF_LINES; i++) {
-            if (file_data.line_lengths[i] < LINE_SIZE) {
-                first_not_full_line = i;
-                break;
-            }
-        }
-        // stop if all lines are full
-        if (first_not_full_line == -1)
-            return;
-
-        // create pointers to current line and its' length
-        char (*line)[LINE_SIZE] = &file_data.data[current_line];
-        int *len = &file_data.line_lengths[current_line];
-
-        // line number before all operations
-        int original_line = current_line;
-        // variable storing previous line's last character
-        char last;
-        // checking if cursor moves to next line after writing
-        int moved_to_next_line = lcd_col >= LINE_SIZE;
-
-        // ------------------------------ 
-        // dealing with the first line
-        // ------------------------------
-        // if cursor doesen't move to the next line
-        if (!moved_to_next_line) {
-            // if line is not full
-            if (*len < LINE_SIZE) {
-                // let the single-line function handle it
-                LineAddChar(chr, *line, len);
-                return;
-            // if line is full
-            } else {
-                // take line's last character and add the char passed by keyboard at cursor position
-                (*len)--;
-                last = (*line)[*len];
-                LineAddChar(chr, *line, len);
-                line++;
-                len++;
-            }
-        // if cursor should move to the next line
-        } else {
-            // skip the first line
-            current_line++;
-            line++;
-            len++;
-            // last character of the first line was supposed to have the char passed by keyboard
-            last = chr;
-            // after writing a new character, cursor will be at the second position
-            lcd_col = 1;
-        
-        }
-        
-        // ------------------------------------------
-        // dealing with all upcoming full lines
-        // shifting all of them right while putting their last characters
-        // at the beginning of the next line
-        // ------------------------------------------
-        for (int i = original_line+1; i < first_not_full_line; i++) {
-            // store next line's last character
-            char new_last = (*line)[LINE_SIZE-1];
-            // shift the line to the right
-            memmove(&(*line)[1], &(*line)[0], LINE_SIZE-1);
-            // add previous line's last character at the beginning of this one
-            (*line)[0] = last;
-            // store next line's last character
-            last = new_last;
-            line++;
-            len++;
-        }
-
-        // ------------------------------------------ 
-        // dealing with the last (non-full) line
-        // ------------------------------------------
-        // shift the line to the right
-        memmove(&(*line)[1], &(*line)[0], *len);
-        // add previous line's last character at the beginning of this one
-        (*line)[0] = last;
-        (*len)++;
-        
-        // ------------------------------------------
-        // printing modified characters that were not updated in-place by LineAddChar
-        // ------------------------------------------
-        // if cursor moved to next line
-        if (moved_to_next_line) {
-            // print next line at the bottom row
-            PrintDataLine(original_line+1, BOTTOM_ROW);
-
-            // if cursor was at the bottom row before moving
-            if (lcd_row = BOTTOM_ROW)
-                // print the unmodified line at top row
-                PrintDataLine(original_line, TOP_ROW);
-
-            // move the cursor to bottom row
-            lcd_row = BOTTOM_ROW;
-        // if cursor didn't move to the next line and was at the top row
-        } else if (lcd_row == TOP_ROW) {
-            // only update the bottom row (top one was updated by LineAddChar)
-            PrintDataLine(original_line+1, BOTTOM_ROW);
-        }
-        // if cursor didn't move to the next line and was at the bottom row, it was updated by LineAddChar
-
-        // set final cursor position
-        SetCursor(lcd_col, lcd_row);
-    }
-    
+    DocumentChange change;
+    const int old_len = DocumentRowLength(current_line);
+    int result;
+    if (insert_mode)
+        result = DocumentReplace(current_line, lcd_col, chr, &change);
+    else
+        result = DocumentInsert(current_line, lcd_col, chr, &change);
+    // stop if the file is full
+    if (result < 0)
+        return;
+    LogEdit(&change);
+    // typing after the end of a full line continues in the next one
+    if (lcd_col == LINE_SIZE)
+        ShowEdit(&change, current_line+1, 1, 0, 0);
+    else
+        ShowEdit(&change, current_line, lcd_col+1, lcd_col, old_len);
 }
 
 /*
     ---
-    Deletes a character from file_data at cursor position, handles multi-line operations
+    Deletes a character at cursor position, handles multi-line operations
     ---
+    at the end of a line the next one is joined to it
 */
 void EditorDelete() {
-    // create pointers to current line and its' length
-    char (*line)[LINE_SIZE] = &file_data.data[current_line];
-    int *len = &file_data.line_lengths[current_line];
-
-    // if cursor is on a character
-    if (lcd_col < *len) {
-        // delete without moving any lines
-        LineDelete(*line, len);
-    // if cursor is not on a character and it's not at the last line
-    } else if (current_line < AMOUNT_OF_LINES-1) {
-        int line_to_delete = current_line;
-        // if line is not empty
-        if (lcd_col > 0) {
-            // stop if next line does not fit into current one
-            if (*(len+1) > LINE_SIZE - *len) {
-                return;
-            // otherwise merge next line with current one
-            } else {
-                int amount_to_move = *(len+1);
-                memmove(&(*line)[lcd_col],
-                        *(line+1),
-                        amount_to_move);
-                (*len) += amount_to_move;
-                // print merged characters
-                PrintN(&(*line)[lcd_col], amount_to_move);
-                // start deleting from the next line
-                line_to_delete++;
-                line++;
-                len++;
-            }
-        // if line is empty
-        } else {
-            // print next line in its' place
-            PrintDataLine(current_line+1, lcd_row);
-        }
-        // delete line by moving all upcoming lines up
-        for (int i = line_to_delete; i < AMOUNT_OF_LINES-1; i++) {
-            memmove(*line, *(line+1), LINE_SIZE);
-            *(len) = *(len+1);
-            line++;
-            len++;
-        }
-        // clear last line (after moving last lines' data is uninitialized)
-        for (int i = 0; i < LINE_SIZE; i++)
-            (*line)[i] = 255;
-        *len = 0;
-        // if deleted at the top row
-        if (lcd_row == TOP_ROW)
-            // print new bottom row after moving lines up
-            PrintDataLine(current_line+1, BOTTOM_ROW);
-        // set final cursor position
-        SetCursor(lcd_col, lcd_row);
-    }
+    DocumentChange change;
+    const int old_len = DocumentRowLength(current_line);
+    if (DocumentDelete(current_line, lcd_col, 0, &change) < 0)
+        return;
+    LogEdit(&change);
+    ShowEdit(&change, current_line, lcd_col, lcd_col, old_len);
 }
 
 /*
     ---
-    Deletes a character from file_data before cursor position, handles multi-line operations
+    Deletes a character before cursor position, handles multi-line operations
     ---
+    at the beginning of a line it's the last character of the previous one if that one is full,
+    otherwise the line is joined to the previous one
 */
 void EditorBackspace() {
-    // create pointers to current line and its' length
-    char (*line)[LINE_SIZE] = &file_data.data[current_line];
-    int *len = &file_data.line_lengths[current_line];
-
-    // delete in-place if cursor is not at line's beginning
+    DocumentChange change;
     if (lcd_col > 0) {
-        SetCursor(--lcd_col, lcd_row);
-        LineDelete(*line, len);
-    //if cursor is at line's beginning and not at first line
+        const int old_len = DocumentRowLength(current_line);
+        if (DocumentDelete(current_line, lcd_col-1, 1, &change) < 0)
+            return;
+        LogEdit(&change);
+        ShowEdit(&change, current_line, lcd_col-1, lcd_col-1, old_len);
     } else if (current_line > 0) {
-        int amount_to_move = *len;
-        // if current line doesent fit into the previous one
-        if (amount_to_move > LINE_SIZE - *(len-1)) {
-            // go to previous line
-            ProcessArrowLeft();
-            line--;
-            len--;
-            // remove 1 character and stop
-            LineBackspace(*line, len);
-        // if current line fits into previous line
-        } else {
-            // merge current line with previous line
-            memmove(&(*(line-1))[*(len-1)],
-                    *line,
-                    amount_to_move);
-            // delete current line by moving all upcoming lines up
-            for (int i = current_line; i < AMOUNT_OF_LINES-1; i++) {
-                memmove(*line, *(line+1), LINE_SIZE);
-                *len = *(len+1);
-                line++;
-                len++;
-            }
-            // clear last line (after moving its' data is uninitialized)
-            for (int i = 0; i < LINE_SIZE; i++)
-                (*line)[i] = 255;
-            *len = 0;
-            // if deleted line was at bottom row on the display
-            if (lcd_row == BOTTOM_ROW) {
-                // print new bottom row after moving lines up
-                PrintDataLine(current_line, BOTTOM_ROW);
-                lcd_col = 0;
-            }
-            // go to previous line
+        const int prev_len = DocumentRowLength(current_line-1);
+        const int col = prev_len == LINE_SIZE ? LINE_SIZE-1 : prev_len;
+        // there's nothing to join after the end of the text, only move to the previous line
+        if (DocumentDelete(current_line-1, col, 1, &change) < 0) {
             ProcessArrowLeft();
-            // increase line's length after merging
-            file_data.line_lengths[current_line] += amount_to_move;
-            // print merged data after line's end
-            PrintN(&file_data.data[current_line][lcd_col], amount_to_move);
-            SetCursor(lcd_col, lcd_row);
+            return;
         }
+        LogEdit(&change);
+        ShowEdit(&change, current_line-1, col, 0, 0);
     }
 }
 
 /*
     ---
-    Moves characters in file_data after the cursor to the next line, handles multi-line operations
+    Moves characters after the cursor into a new line, handles multi-line operations
     ---
 */
 void EditorEnter() {
-    // check if there is space to create a new line
-    int has_empty_line = -1;
-    for (int i = current_line+1; i < AMOUNT_OF_LINES; i++) {
-        if (file_data.line_lengths[i] == 0) {
-            has_empty_line = 1;
-            break;
+    DocumentChange change;
+    // stop if there's no room for another line
+    if (DocumentInsert(current_line, lcd_col, '\n', &change) < 0)
+        return;
+    LogEdit(&change);
+    // new line starts after the full lines left before the cursor
+    ShowEdit(&change, current_line + lcd_col / LINE_SIZE + 1, 0, 0, 0);
+}
+
+/*
+    ---
+    Takes back the last step of editing (or does it again if parameter 'redo' is set)
+    ---
+    only lines the step changed are printed again, cursor goes where the step happened
+*/
+void EditorUndo(int redo) {
+    DocumentChange change;
+    int line, col;
+    const int result = redo ? DocumentRedo(&change, &line, &col) : DocumentUndo(&change, &line, &col);
+    if (result < 0)
+        return;
+    LogEdit(&change);
+    ShowEdit(&change, line, col, 0, LINE_SIZE);
+}
+
+// copies selected text into the clipboard and stops selecting, too long text isn't copied
+void EditorCopy() {
+    const int len = DocumentCopy(selection_line, selection_col, current_line, lcd_col, clipboard, CLIPBOARD_SIZE);
+    if (len < 0)
+        return;
+    clipboard_len = len;
+    selecting = 0;
+    ShowCursorMode();
+}
+
+/*
+    ---
+    Removes selected text, it goes to the clipboard first if parameter 'copy' is set
+    ---
+    text is removed as one edit, changed lines are printed once
+*/
+void EditorCutSelection(int copy) {
+    DocumentChange change;
+    int line, col;
+    if (copy) {
+        const int len = DocumentCopy(selection_line, selection_col, current_line, lcd_col, clipboard, CLIPBOARD_SIZE);
+        if (len < 0)
+            return;
+        clipboard_len = len;
+    }
+    selecting = 0;
+    ShowCursorMode();
+    if (DocumentSplice(selection_line, selection_col, current_line, lcd_col, NULL, 0, &change, &line, &col) < 0)
+        return;
+    LogEdit(&change);
+    ShowEdit(&change, line, col, 0, LINE_SIZE);
+}
+
+/*
+    ---
+    Puts the clipboard at the cursor, in place of selected text if there's some
+    ---
+    whole text is put in as one edit, so lines after it are cut again once
+    and changed lines are printed once, cursor goes after it
+*/
+void EditorPaste() {
+    DocumentChange change;
+    int line, col;
+    const int to_line = selecting ? selection_line : current_line;
+    const int to_col = selecting ? selection_col : lcd_col;
+    if (clipboard_len == 0)
+        return;
+    selecting = 0;
+    ShowCursorMode();
+    // stop if the file is full
+    if (DocumentSplice(current_line, lcd_col, to_line, to_col, clipboard, clipboard_len, &change, &line, &col) < 0)
+        return;
+    LogEdit(&change);
+    ShowEdit(&change, line, col, 0, LINE_SIZE);
+}
+
+/*
+    ---
+    Removes the line with the cursor
+    ---
+    line is the whole paragraph (with full lines before it and the ones it continues in),
+    lines after it only move up, so only its removal is logged
+*/
+void EditorDeleteLine() {
+    DocumentChange change;
+    int line, col;
+    if (DocumentDeleteLine(current_line, &change, &line, &col) < 0)
+        return;
+    LogEdit(&change);
+    ShowEdit(&change, line, col, 0, LINE_SIZE);
+}
+
+// puts a copy of the line with the cursor after it, cursor goes to the copy
+void EditorDuplicateLine() {
+    DocumentChange change;
+    int line, col;
+    // stop if the file is full
+    if (DocumentDuplicateLine(current_line, lcd_col, &change, &line, &col) < 0)
+        return;
+    LogEdit(&change);
+    ShowEdit(&change, line, col, 0, LINE_SIZE);
+}
+
+// swaps the line with the cursor with the previous one (or the next one if 'up' isn't set), cursor goes along
+void EditorMoveLine(int up) {
+    DocumentChange change;
+    int line, col;
+    if (DocumentMoveLine(current_line, lcd_col, up, &change, &line, &col) < 0)
+        return;
+    LogEdit(&change);
+    ShowEdit(&change, line, col, 0, LINE_SIZE);
+}
+
+/*
+    ---
+    Moves the cursor to the next occurrence of the last searched text (or the previous one if 'backwards' is set)
+    ---
+    search goes on from the other end of the text when it gets to an end,
+    display only scrolls when the occurrence isn't shown already
+*/
+void EditorFindNext(int backwards) {
+    int line, col;
+    if (search_len == 0 || !FindWrapped(current_line, backwards ? lcd_col : lcd_col+1, backwards, &line, &col))
+        return;
+    const DocumentChange nothing = { 0, 0, 0 };
+    ShowEdit(&nothing, line, col, 0, 0);
+}
+
+/*
+    ---
+    Finds the searched text from a position on (or before it if 'backwards' is set)
+    ---
+    starts over from the other end of the text if there's no occurrence up to its end
+    returns 1 if it was found and 0 otherwise
+*/
+int FindWrapped(int line, int col, int backwards, int* found_line, int* found_col) {
+    if (DocumentFind(search_buf, search_len, line, col, backwards, found_line, found_col) == 0)
+        return 1;
+    return DocumentFind(search_buf, search_len, backwards ? AMOUNT_OF_LINES : 0, 0, backwards, found_line, found_col) == 0;
+}
+
+// adds a character to the searched text, first occurrence from where the search started is shown
+void SearchAddChar(char chr) {
+    if (search_len >= LINE_SIZE-1)
+        return;
+    search_buf[search_len++] = chr;
+    SetCursor(search_len, BOTTOM_ROW);
+    Write(chr);
+    SearchShow(FindWrapped(search_origin_line, search_origin_col, 0, &search_line, &search_col));
+}
+
+// removes the last character of the searched text, search starts over from where it started
+void SearchBackspace() {
+    if (search_len == 0)
+        return;
+    SetCursor(search_len--, BOTTOM_ROW);
+    Write(' ');
+    if (search_len == 0) {
+        search_line = search_origin_line;
+        search_col = search_origin_col;
+        SearchShow(1);
+    } else {
+        SearchShow(FindWrapped(search_origin_line, search_origin_col, 0, &search_line, &search_col));
+    }
+}
+
+// moves to the next occurrence of the searched text (or the previous one if 'backwards' is set)
+void SearchStep(int backwards) {
+    if (search_len == 0 || search_shown < 0)
+        return;
+    SearchShow(FindWrapped(search_line, backwards ? search_col : search_col+1, backwards, &search_line, &search_col));
+}
+
+/*
+    ---
+    Shows the line with the current occurrence above the searched text
+    ---
+    line is only printed if another one was shown, cursor marks where the occurrence starts
+*/
+void SearchShow(int found) {
+    if (!found) {
+        if (search_shown >= 0) {
+            SetCursor(0, TOP_ROW);
+            Print("Not found       ");
         }
+        search_shown = -1;
+        lcd_col = search_len + 1;
+        lcd_row = BOTTOM_ROW;
+    } else {
+        if (search_shown != search_line)
+            PrintDataLine(search_line, TOP_ROW);
+        search_shown = search_line;
+        lcd_col = search_col;
+        lcd_row = TOP_ROW;
+    }
+    SetCursor(lcd_col, lcd_row);
+}
+
+// shows that files are being searched, they are searched once that's on the screen
+void SearchFiles() {
+    CursorOff();
+    BlinkingOff();
+    ClearDisplay();
+    Print("Searching...");
+    busy = 1;
+    search_file = 0;
+    search_result_count = 0;
+    LoopDefer(FindInFiles);
+}
+
+/*
+    ---
+    Looks for the searched text in the next file that could hold it, lists the files holding it at the end
+    ---
+    signature saved with a file tells if the text can't be there, such file isn't loaded at all
+    file with a save on its way has newer text than its signature, it's searched in the cache
+    only one file is loaded per loop pass, so the keyboard keeps being polled, the rest is deferred
+    file is loaded into its own buffer, the edited file and the document stay as they are
+*/
+void FindInFiles() {
+    for (; search_file < AMOUNT_OF_FILES; search_file++) {
+        const int i = search_file;
+        if (files_info.name_lengths[i] == 0)
+            continue;
+        if (!FileSavePending(i) && !FileMayContain(i, search_buf, search_len))
+            continue;
+        CachePeekFile(&search_data, i);
+        if (DocumentFileHolds(&search_data, search_buf, search_len))
+            search_results[search_result_count++] = i;
+        search_file++;
+        LoopDefer(FindInFiles);
+        return;
     }
-    // stop if there are no empty lines
-    if (has_empty_line == -1)
+
+    busy = 0;
+    if (search_result_count == 0) {
+        ShowStatus("Not found", ShowFileSelection);
         return;
+    }
+    SearchResultsAt(0);
+}
 
-    // create pointers to last line and its' length
-    char (*line)[LINE_SIZE] = &file_data.data[AMOUNT_OF_LINES-1];
-    int *len = &file_data.line_lengths[AMOUNT_OF_LINES-1];
+/*
+    ---
+    Opens the selected file in the editor
+    ---
+    file with a pending save is opened right away from the cache, which keeps it until the save lands,
+    damaged file is opened after a message about it
+    returns 1 if the file is shown in the editor and 0 otherwise
+*/
+int OpenFile() {
+    const int saving = FileSavePending(current_file);
+    const int damaged = CacheGetFile(&file_data, current_file) < 0;
+    // if that save fails, closing the file saves it again (even without changes), which drops the failed one
+    if (saving)
+        file_data.dirty = 1;
+    DocumentLoad(&file_data);
+    EditLogStart(&file_data, current_file);
+    if (damaged) {
+        ShowStatus("File damaged", TextEditorDefaults);
+        return 0;
+    }
+    TextEditorDefaults();
+    return 1;
+}
 
-    // move lines up until it hits the newly created one
-    // after this loop (*line) points at newly created line
-    for (char (*new_line)[LINE_SIZE] = &file_data.data[current_line+1]; line > new_line; line--, len--) {
-        memmove(*line, *(line-1), LINE_SIZE);
-        *len = *(len-1);
+/*
+    ---
+    Replaces every occurrence of the searched text in the document
+    ---
+    text is rewritten in one pass (see document.c), changed lines are logged like any edit,
+    amount of replaced occurrences is shown and then the editor is printed once where the cursor was
+*/
+void EditorReplaceAll() {
+    DocumentChange change;
+    char message[MAX_CHARS + 1];
+    const int count = DocumentReplaceAll(search_buf, search_len, replace_buf, replace_len, &change);
+
+    if (count < 0) {
+        ShowStatus("Text too long", ShowSearchOrigin);
+    } else if (count == 0) {
+        ShowStatus("Not found", ShowSearchOrigin);
+    } else {
+        LogEdit(&change);
+        itoa(count, message, 10);
+        strcat(message, " replaced");
+        ShowStatus(message, ShowSearchOrigin);
     }
-    // move data after cursor from current line into newly created (which is right after current line)
-    int amount_to_move = *(len-1) - lcd_col;
-    memmove(*line,
-        &(*(line-1))[lcd_col],
-        amount_to_move);
-    // set newly created line's length
-    *len = amount_to_move;
-    // clear uninitialized data from newly created line
-    for (int i = amount_to_move; i < LINE_SIZE; i++)
-        (*line)[i] = 255;
-    // go to current line
-    line--;
-    len--;
-    // clear moved characters from current line
-    for (int i = lcd_col; i < *len; i++) {
-        (*line)[i] = 255;
-        Write(' ');
+}
+
+/*
+    ---
+    Logs lines changed by an edit
+    ---
+    lines after them only moved, which takes a single record if their amount changed
+*/
+void LogEdit(const DocumentChange* change) {
+    char line[LINE_SIZE];
+    const int end = change->first + change->new_rows;
+    // lines past the end of a file aren't stored
+    for (int i = change->new_rows; i < change->old_rows && end < AMOUNT_OF_LINES; i++)
+        EditLogDeleteLine(end);
+    for (int i = change->old_rows; i < change->new_rows && change->first + change->old_rows < AMOUNT_OF_LINES; i++)
+        EditLogInsertLine(change->first + change->old_rows);
+    for (int i = change->first; i < end && i < AMOUNT_OF_LINES; i++) {
+        const int len = DocumentRow(i, line);
+        EditLogLine(i, line, len);
     }
-    // decrease current line's length after moving
-    *len -= amount_to_move;
-    // go to next line on screen and print newly created line in it 
-    ProcessArrowRight();
-    PrintDataLine(current_line, lcd_row);
-    // set final cursor position
-    lcd_col = 0;
+}
+
+/*
+    ---
+    Shows an edit on the display and moves the cursor to 'line' and 'col'
+    ---
+    changed lines that stay on the display are printed again, the line with the cursor only from column 'from'
+    if nothing else changed ('old_len' is its length before the edit)
+    display scrolls only as far as needed to show the new cursor position
+*/
+void ShowEdit(const DocumentChange* change, int line, int col, int from, int old_len) {
+    const int top = lcd_row == TOP_ROW ? current_line : current_line-1;
+    int new_top = top;
+    if (line < top)
+        new_top = line;
+    else if (line > top+1)
+        new_top = line-1;
+    // lines after the changed ones only move if their amount changed
+    const int last = change->old_rows == change->new_rows ? change->first + change->new_rows-1 : AMOUNT_OF_LINES-1;
+    const int single_line = change->first == current_line && last == current_line;
+
+    for (int i = 0; i < 2; i++) {
+        const int pos = new_top + i;
+        const int row = i == 0 ? TOP_ROW : BOTTOM_ROW;
+        if (new_top == top && single_line && pos == current_line)
+            PrintDataLinePart(pos, row, from, old_len);
+        else if (new_top != top || (pos >= change->first && pos <= last))
+            PrintDataLine(pos, row);
+    }
+    current_line = line;
+    lcd_row = line == new_top ? TOP_ROW : BOTTOM_ROW;
+    lcd_col = col;
+    SetCursor(lcd_col, lcd_row);
+}
+
+// prints the editor again with 'line' on display 'row' and the cursor at 'col' in it (after a search)
+void ShowLines(int line, int col, int row) {
+    current_menu = TextEditor;
+    ShowCursorMode();
+    const int top = row == TOP_ROW ? line : line-1;
+    PrintDataLine(top, TOP_ROW);
+    PrintDataLine(top+1, BOTTOM_ROW);
+    current_line = line;
+    lcd_row = row;
+    lcd_col = col;
     SetCursor(lcd_col, lcd_row);
-}
\ No newline at end of file
+}
+
+// cursor blinks over a character in insert mode, when selecting it's both underlined and blinking
+void ShowCursorMode() {
+    if (selecting) {
+        CursorOn();
+        BlinkingOn();
+    } else if (insert_mode) {
+        CursorOff();
+        BlinkingOn();
+    } else {
+        CursorOn();
+        BlinkingOff();
+    }
+}
+
+/*
+    ---
+    Takes back files that core1 couldn't save
+    ---
+    unsaved file is opened in the editor, so the changes aren't lost
+    and user can make space and try again
+    returns 1 if a file was reopened
+*/
+int CheckSaves() {
+    int pos;
+    SaveStatus status;
+    while ((status = PollSave(&file_data, &pos)) != SaveNone) {
+        if (status != SaveFailed)
+            continue;
+        current_file = pos;
+        // cached copy isn't what's in flash
+        CacheDropFile(pos);
+        DocumentLoad(&file_data);
+        EditLogStart(&file_data, current_file);
+        ShowStatus("Storage full", TextEditorDefaults);
+        return 1;
+    }
+    return 0;
+}
@@ -1,6 +1,8 @@
 #pragma once
 
 void ProcessMount();
+void ProcessInput();
+int ProcessKeyPress();
 void ProcessChar(char chr);
 void ProcessArrowLeft();
 void ProcessArrowRight();
@@ -16,5 +18,16 @@ void ProcessPageDown();
 void ProcessPageUp();
 void ProcessHome();
 void ProcessEnd();
+void ProcessUndo();
+void ProcessRedo();
+void ProcessSelect(int extend);
+void ProcessCopy(int cut);
+void ProcessPaste();
+void ProcessDeleteLine();
+void ProcessDuplicateLine();
+void ProcessMoveLine(int up);
+void ProcessSearch();
+void ProcessReplace();
+void ProcessSearchNext(int backwards);
 
 void EditorInitialize();
\ No newline at end of file
@@ -0,0 +1,125 @@
+#include "loop.h"
+#include "lcd.h"
+#include "tusb.h"
+#include "pico/stdlib.h"
+
+/*
+    Run loop
+
+    Every pass handles keyboard reports (tuh_task()), sends what they changed on the screen,
+    then runs deferred callbacks, timers that are due and the idle work. Nothing on the way
+    sleeps, anything that has to happen later is a timer, so input keeps flowing while it waits.
+    Callbacks run on core0 between passes, never from an interrupt.
+*/
+
+#define MAX_TIMERS (8)
+#define MAX_DEFERRED (8)
+
+typedef struct LoopTimer {
+    LoopCallback callback;      // NULL for a free slot
+    uint32_t due;               // ms since boot
+    uint32_t period;            // 0 for a one-shot timer
+} LoopTimer;
+
+LoopTimer loop_timers[MAX_TIMERS];
+LoopCallback loop_deferred[MAX_DEFERRED];
+int loop_deferred_count = 0;
+
+// internal functions
+static uint32_t Now();
+static void RunDeferred();
+static void RunTimers();
+
+// ----------------------------------------------------
+// functions exposed in the header file
+// ----------------------------------------------------
+
+/*
+    ---
+    Calls 'callback' after 'delay_ms' and then every 'period_ms' if it's not 0
+    ---
+    returns 0 or -1 if all timers are taken
+*/
+int LoopAddTimer(uint32_t delay_ms, uint32_t period_ms, LoopCallback callback) {
+    for (int i = 0; i < MAX_TIMERS; i++) {
+        if (loop_timers[i].callback != NULL)
+            continue;
+        loop_timers[i].callback = callback;
+        loop_timers[i].due = Now() + delay_ms;
+        loop_timers[i].period = period_ms;
+        return 0;
+    }
+    return -1;
+}
+
+// stops every timer calling 'callback'
+void LoopCancelTimer(LoopCallback callback) {
+    for (int i = 0; i < MAX_TIMERS; i++)
+        if (loop_timers[i].callback == callback)
+            loop_timers[i].callback = NULL;
+}
+
+/*
+    ---
+    Calls 'callback' once in the next pass, after the screen is sent
+    ---
+    deferring one that's already waiting doesn't call it twice
+    returns 0 or -1 if there's no room for it
+*/
+int LoopDefer(LoopCallback callback) {
+    for (int i = 0; i < loop_deferred_count; i++)
+        if (loop_deferred[i] == callback)
+            return 0;
+    if (loop_deferred_count == MAX_DEFERRED)
+        return -1;
+    loop_deferred[loop_deferred_count++] = callback;
+    return 0;
+}
+
+// runs the loop forever, 'idle' is called at the end of every pass
+void LoopRun(LoopCallback idle) {
+    while (1) {
+        tuh_task();
+        UpdateDisplay();
+        RunDeferred();
+        RunTimers();
+        idle();
+    }
+}
+
+// ----------------------------------------------------
+// internal functions
+// ----------------------------------------------------
+
+static uint32_t Now() {
+    return to_ms_since_boot(get_absolute_time());
+}
+
+// callbacks deferred while these run wait for the next pass
+static void RunDeferred() {
+    const int count = loop_deferred_count;
+    LoopCallback callbacks[MAX_DEFERRED];
+    for (int i = 0; i < count; i++)
+        callbacks[i] = loop_deferred[i];
+    loop_deferred_count = 0;
+    for (int i = 0; i < count; i++)
+        callbacks[i]();
+}
+
+static void RunTimers() {
+    const uint32_t now = Now();
+    for (int i = 0; i < MAX_TIMERS; i++) {
+        const LoopCallback callback = loop_timers[i].callback;
+        if (callback == NULL || (int32_t)(now - loop_timers[i].due) < 0)
+            continue;
+        // slot is freed or rescheduled first, the callback may add or cancel timers
+        if (loop_timers[i].period == 0) {
+            loop_timers[i].callback = NULL;
+        } else {
+            loop_timers[i].due += loop_timers[i].period;
+            if ((int32_t)(now - loop_timers[i].due) >= 0)
+                loop_timers[i].due = now + loop_timers[i].period;
+        }
+        callback();
+    }
+}
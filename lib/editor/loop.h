@@ -0,0 +1,10 @@
+#pragma once
+
+#include <inttypes.h>
+
+typedef void (*LoopCallback)();
+
+int LoopAddTimer(uint32_t delay_ms, uint32_t period_ms, LoopCallback callback);
+void LoopCancelTimer(LoopCallback callback);
+int LoopDefer(LoopCallback callback);
+void LoopRun(LoopCallback idle);
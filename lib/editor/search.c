@@ -0,0 +1,113 @@
+#include <string.h>
+#include <inttypes.h>
+#include "search.h"
+
+/*
+    Substring search kernel
+
+    Pattern of a single character is looked for a word at a time (SWAR): 4 bytes are checked
+    for it with a few arithmetic operations, only a word holding it is looked into byte by byte.
+    Longer patterns use Horspool: last character of the window is compared first and the window
+    jumps by the distance of the character under it from the end of the pattern,
+    so most of the text is skipped without being compared.
+    Cortex-M0+ can't load unaligned words, words are only read from aligned addresses.
+*/
+
+#define ONES (0x01010101u)
+#define HIGHS (0x80808080u)
+// tells if a word has a zero byte
+#define HAS_ZERO(x) (((x) - ONES) & ~(x) & HIGHS)
+// skip distances have to fit in a byte
+#define MAX_PATTERN (255)
+
+// how far the window moves for every character under it, filled for every search
+uint8_t search_skip[256];
+
+// internal functions
+static int FindChar(const char* text, int len, char chr);
+static int FindCharBackward(const char* text, int len, char chr);
+
+// ----------------------------------------------------
+// functions exposed in the header file
+// ----------------------------------------------------
+
+// returns position of the first occurrence of the pattern in the text or -1 if there's none
+int SearchForward(const char* text, int len, const char* pattern, int pattern_len) {
+    if (pattern_len <= 0 || pattern_len > MAX_PATTERN || pattern_len > len)
+        return -1;
+    if (pattern_len == 1)
+        return FindChar(text, len, pattern[0]);
+
+    memset(search_skip, pattern_len, sizeof(search_skip));
+    for (int i = 0; i < pattern_len-1; i++)
+        search_skip[(uint8_t)pattern[i]] = pattern_len-1 - i;
+
+    const char last = pattern[pattern_len-1];
+    for (int pos = 0; pos <= len - pattern_len; pos += search_skip[(uint8_t)text[pos + pattern_len-1]])
+        if (text[pos + pattern_len-1] == last && memcmp(&text[pos], pattern, pattern_len-1) == 0)
+            return pos;
+    return -1;
+}
+
+// returns position of the last occurrence of the pattern in the text or -1 if there's none
+int SearchBackward(const char* text, int len, const char* pattern, int pattern_len) {
+    if (pattern_len <= 0 || pattern_len > MAX_PATTERN || pattern_len > len)
+        return -1;
+    if (pattern_len == 1)
+        return FindCharBackward(text, len, pattern[0]);
+
+    // mirrored Horspool, window moves left by the distance of the character under its start
+    memset(search_skip, pattern_len, sizeof(search_skip));
+    for (int i = pattern_len-1; i > 0; i--)
+        search_skip[(uint8_t)pattern[i]] = i;
+
+    const char first = pattern[0];
+    for (int pos = len - pattern_len; pos >= 0; pos -= search_skip[(uint8_t)text[pos]])
+        if (text[pos] == first && memcmp(&text[pos+1], &pattern[1], pattern_len-1) == 0)
+            return pos;
+    return -1;
+}
+
+// ----------------------------------------------------
+// internal functions
+// ----------------------------------------------------
+
+static int FindChar(const char* text, int len, char chr) {
+    int pos = 0;
+    // bytes before the first aligned word
+    for (; pos < len && ((uintptr_t)&text[pos] & 3) != 0; pos++)
+        if (text[pos] == chr)
+            return pos;
+
+    const uint32_t pattern = (uint8_t)chr * ONES;
+    for (; pos + 4 <= len; pos += 4) {
+        const uint32_t word = *(const uint32_t*)&text[pos] ^ pattern;
+        if (HAS_ZERO(word))
+            break;
+    }
+    // word holding the character or bytes after the last aligned word
+    for (; pos < len; pos++)
+        if (text[pos] == chr)
+            return pos;
+    return -1;
+}
+
+static int FindCharBackward(const char* text, int len, char chr) {
+    int pos = len;
+    // bytes after the last aligned word
+    while (pos > 0 && ((uintptr_t)&text[pos] & 3) != 0)
+        if (text[--pos] == chr)
+            return pos;
+
+    const uint32_t pattern = (uint8_t)chr * ONES;
+    for (; pos >= 4; pos -= 4) {
+        const uint32_t word = *(const uint32_t*)&text[pos-4] ^ pattern;
+        if (HAS_ZERO(word))
+            break;
+    }
+    // word holding the character or bytes before the first aligned word
+    while (pos > 0)
+        if (text[--pos] == chr)
+            return pos;
+    return -1;
+}
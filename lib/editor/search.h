@@ -0,0 +1,4 @@
+#pragma once
+
+int SearchForward(const char* text, int len, const char* pattern, int pattern_len);
+int SearchBackward(const char* text, int len, const char* pattern, int pattern_len);
@@ -0,0 +1,229 @@
+#include <string.h>
+#include "undo.h"
+
+/*
+    Undo history
+
+    Steps are kept as compact records in a fixed ring of bytes, the oldest ones
+    are dropped when a new one doesn't fit. Every record is:
+    - type, amount of characters and text position (4 bytes)
+    - characters (old and new one in turns for a replace)
+    - size of the whole record, so the ring can be walked back from its end
+
+    Typing, deleting or overwriting characters one after another grows the newest record
+    instead of adding one, so a step undoes a whole run. Line breaks always take a step of their own,
+    only a block (cut or pasted text) can hold them among other characters.
+    Moved line only keeps its length and the length of the line it swapped places with.
+    Undone steps stay after the current position until something new is recorded.
+*/
+
+#define UNDO_ARENA_SIZE (1024)
+#define HEADER_SIZE (4)
+#define BREAK ('\n')
+
+uint8_t undo_arena[UNDO_ARENA_SIZE];
+// ring positions only grow, (position % UNDO_ARENA_SIZE) is the byte in the arena
+// oldest record, end of undoable records (start of undone ones) and end of undone records
+uint32_t undo_start = 0;
+uint32_t undo_pos = 0;
+uint32_t undo_end = 0;
+// set when the newest record can't grow anymore (after a line break, undo or redo)
+int undo_sealed = 1;
+
+// internal functions
+static inline uint8_t Get(uint32_t pos);
+static inline void Put(uint32_t pos, uint8_t byte);
+static int PayloadSize(uint32_t start);
+static int TopRecord(uint8_t type, uint32_t* start);
+static void MakeRoom(int size, uint32_t keep);
+static void Grow(uint32_t start, const char* bytes, int len, int prepend);
+static void Push(uint8_t type, int pos, const char* bytes, int len);
+static void ReadStep(uint32_t start, UndoStep* step);
+
+// ----------------------------------------------------
+// functions exposed in the header file
+// ----------------------------------------------------
+
+// forgets every step (done when another file is opened)
+void UndoClear() {
+    undo_start = 0;
+    undo_pos = 0;
+    undo_end = 0;
+    undo_sealed = 1;
+}
+
+// records a character inserted at 'pos', typing goes to the newest record if it continues it
+void UndoRecordInsert(int pos, char chr) {
+    uint32_t start;
+    if (chr != BREAK && TopRecord(StepInsert, &start)
+        && Get(start + 2) + (Get(start + 3) << 8) + Get(start + 1) == pos) {
+        Grow(start, &chr, 1, 0);
+        return;
+    }
+    Push(StepInsert, pos, &chr, 1);
+    undo_sealed = chr == BREAK;
+}
+
+/*
+    ---
+    Records a character removed from 'pos'
+    ---
+    parameter 'backwards' tells the character was before the cursor (backspace),
+    so the next one removed the same way comes before it
+*/
+void UndoRecordDelete(int pos, char chr, int backwards) {
+    uint32_t start;
+    if (chr != BREAK && TopRecord(StepDelete, &start)) {
+        const int first = Get(start + 2) + (Get(start + 3) << 8);
+        if (!backwards && first == pos) {
+            Grow(start, &chr, 1, 0);
+            return;
+        }
+        if (backwards && first == pos + 1) {
+            Grow(start, &chr, 1, 1);
+            return;
+        }
+    }
+    Push(StepDelete, pos, &chr, 1);
+    undo_sealed = chr == BREAK;
+}
+
+// records a character at 'pos' overwritten in insert mode
+void UndoRecordReplace(int pos, char old, char chr) {
+    const char pair[2] = { old, chr };
+    uint32_t start;
+    if (TopRecord(StepReplace, &start)
+        && Get(start + 2) + (Get(start + 3) << 8) + Get(start + 1) == pos) {
+        Grow(start, pair, 2, 0);
+        return;
+    }
+    Push(StepReplace, pos, pair, 2);
+    undo_sealed = 0;
+}
+
+/*
+    ---
+    Records a block of characters inserted at 'pos' (or removed from it if 'type' is StepDelete)
+    ---
+    block is a step of its own, one that's too long for a step can't be undone
+    and neither can anything before it, so the history is dropped
+*/
+void UndoRecordBlock(StepType type, int pos, const char* chars, int len) {
+    if (len > UNDO_MAX_RUN) {
+        UndoClear();
+        return;
+    }
+    Push(type, pos, chars, len);
+    undo_sealed = 1;
+}
+
+// records lines swapped at 'pos', 'first' characters with 'second' ones after them (line breaks included)
+void UndoRecordMove(int pos, int first, int second) {
+    const char lengths[4] = { first & 0xFF, first >> 8, second & 0xFF, second >> 8 };
+    Push(StepMove, pos, lengths, 4);
+    undo_sealed = 1;
+}
+
+// takes the newest step that wasn't undone, returns 0 if there's none and 1 otherwise
+int UndoPrevious(UndoStep* step) {
+    if (undo_pos == undo_start)
+        return 0;
+    undo_pos -= Get(undo_pos - 1);
+    ReadStep(undo_pos, step);
+    undo_sealed = 1;
+    return 1;
+}
+
+// takes the oldest undone step, returns 0 if there's none and 1 otherwise
+int UndoNext(UndoStep* step) {
+    if (undo_pos == undo_end)
+        return 0;
+    ReadStep(undo_pos, step);
+    undo_pos += HEADER_SIZE + PayloadSize(undo_pos) + 1;
+    undo_sealed = 1;
+    return 1;
+}
+
+// ----------------------------------------------------
+// internal functions
+// ----------------------------------------------------
+
+static inline uint8_t Get(uint32_t pos) {
+    return undo_arena[pos % UNDO_ARENA_SIZE];
+}
+
+static inline void Put(uint32_t pos, uint8_t byte) {
+    undo_arena[pos % UNDO_ARENA_SIZE] = byte;
+}
+
+static int PayloadSize(uint32_t start) {
+    return Get(start) == StepReplace ? 2 * Get(start + 1) : Get(start + 1);
+}
+
+// finds the newest record if it has the type and can still grow, returns 1 if it does
+static int TopRecord(uint8_t type, uint32_t* start) {
+    if (undo_sealed || undo_pos != undo_end || undo_pos == undo_start)
+        return 0;
+    *start = undo_pos - Get(undo_pos - 1);
+    return Get(*start) == type && Get(*start + 1) < UNDO_MAX_RUN;
+}
+
+// drops the oldest records (never the one at 'keep') until 'size' more bytes fit
+static void MakeRoom(int size, uint32_t keep) {
+    while (undo_end + size - undo_start > UNDO_ARENA_SIZE && undo_start != keep)
+        undo_start += HEADER_SIZE + PayloadSize(undo_start) + 1;
+}
+
+// adds bytes of one more character at the end (or the start) of the newest record
+static void Grow(uint32_t start, const char* bytes, int len, int prepend) {
+    MakeRoom(len, start);
+    const uint32_t payload = start + HEADER_SIZE;
+    const int size = PayloadSize(start);
+    if (prepend) {
+        for (int i = size - 1; i >= 0; i--)
+            Put(payload + i + len, Get(payload + i));
+        for (int i = 0; i < len; i++)
+            Put(payload + i, bytes[i]);
+        const int pos = Get(start + 2) + (Get(start + 3) << 8) - 1;
+        Put(start + 2, pos & 0xFF);
+        Put(start + 3, pos >> 8);
+    } else {
+        for (int i = 0; i < len; i++)
+            Put(payload + size + i, bytes[i]);
+    }
+    Put(start + 1, Get(start + 1) + 1);
+    undo_end += len;
+    undo_pos = undo_end;
+    Put(undo_end - 1, undo_end - start);
+}
+
+// adds a new record, undone steps are dropped
+static void Push(uint8_t type, int pos, const char* bytes, int len) {
+    const int size = HEADER_SIZE + len + 1;
+    undo_end = undo_pos;
+    MakeRoom(size, undo_end);
+    const uint32_t start = undo_end;
+    Put(start, type);
+    Put(start + 1, type == StepReplace ? len / 2 : len);
+    Put(start + 2, pos & 0xFF);
+    Put(start + 3, pos >> 8);
+    for (int i = 0; i < len; i++)
+        Put(start + HEADER_SIZE + i, bytes[i]);
+    Put(start + size - 1, size);
+    undo_end += size;
+    undo_pos = undo_end;
+}
+
+static void ReadStep(uint32_t start, UndoStep* step) {
+    step->type = Get(start);
+    step->amount = Get(start + 1);
+    step->pos = Get(start + 2) + (Get(start + 3) << 8);
+    for (int i = 0; i < step->amount; i++) {
+        if (step->type == StepReplace) {
+            step->replaced[i] = Get(start + HEADER_SIZE + 2*i);
+            step->chars[i] = Get(start + HEADER_SIZE + 2*i + 1);
+        } else {
+            step->chars[i] = Get(start + HEADER_SIZE + i);
+        }
+    }
+}
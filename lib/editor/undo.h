@@ -0,0 +1,30 @@
+#pragma once
+
+#include <inttypes.h>
+
+// most characters a single step holds, longer typing takes more steps
+#define UNDO_MAX_RUN (64)
+
+typedef enum StepType {
+    StepInsert = 1,         // characters were inserted at 'pos'
+    StepDelete,             // characters were removed from 'pos'
+    StepReplace,            // characters from 'pos' were overwritten, 'replaced' has the old ones
+    StepMove                // line at 'pos' swapped places with the next one, 'chars' has lengths of both
+} StepType;
+
+typedef struct UndoStep {
+    uint8_t type;           // StepType
+    uint8_t amount;
+    uint16_t pos;
+    char chars[UNDO_MAX_RUN];
+    char replaced[UNDO_MAX_RUN];
+} UndoStep;
+
+void UndoClear();
+void UndoRecordInsert(int pos, char chr);
+void UndoRecordDelete(int pos, char chr, int backwards);
+void UndoRecordReplace(int pos, char old, char chr);
+void UndoRecordBlock(StepType type, int pos, const char* chars, int len);
+void UndoRecordMove(int pos, int first, int second);
+int UndoPrevious(UndoStep* step);
+int UndoNext(UndoStep* step);
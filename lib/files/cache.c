@@ -0,0 +1,118 @@
+#include <string.h>
+#include "pico/stdlib.h"
+#include "cache.h"
+#include "saver.h"
+
+/*
+    File cache
+
+    Recently used files are kept unpacked in RAM, so opening one of them again
+    is a copy instead of a flash read. Least recently used file makes room for a new one.
+
+    Saved files go into the cache right away while core1 writes them back to flash.
+    Such entry is dirty until its save finishes, it can only be evicted after that,
+    so a file never leaves the cache before it's in flash.
+*/
+
+// every entry takes sizeof(FileData), a bit over 5KB
+#define CACHE_FILES (8)
+
+typedef struct CacheEntry {
+    int pos;                // -1 if the entry is empty
+    uint32_t last_used;
+    FileData data;
+} CacheEntry;
+
+CacheEntry cache_entries[CACHE_FILES];
+// bigger for every use of an entry
+uint32_t cache_clock = 0;
+
+// internal functions
+static CacheEntry* FindEntry(int pos);
+static CacheEntry* EvictEntry();
+
+// ----------------------------------------------------
+// functions exposed in the header file
+// ----------------------------------------------------
+
+void CacheInitialize() {
+    for (int i = 0; i < CACHE_FILES; i++)
+        cache_entries[i].pos = -1;
+}
+
+/*
+    ---
+    Loads a file, from the cache if it's there
+    ---
+    returns -1 if the file is damaged (it's loaded as empty and isn't cached) and 0 on success
+*/
+int CacheGetFile(FileData* file_data, int pos) {
+    CacheEntry* entry = FindEntry(pos);
+    if (entry != NULL) {
+        memcpy(file_data, &entry->data, sizeof(FileData));
+        entry->last_used = ++cache_clock;
+        return 0;
+    }
+
+    if (GetFileData(file_data, pos) < 0)
+        return -1;
+    CachePutFile(file_data, pos);
+    return 0;
+}
+
+// loads a file without making it recently used, a file that isn't cached doesn't go in (for a search through files)
+int CachePeekFile(FileData* file_data, int pos) {
+    const CacheEntry* entry = FindEntry(pos);
+    if (entry == NULL)
+        return GetFileData(file_data, pos);
+    memcpy(file_data, &entry->data, sizeof(FileData));
+    return 0;
+}
+
+// puts a copy of the file in the cache, meant for files that were just loaded or saved
+void CachePutFile(const FileData* file_data, int pos) {
+    CacheEntry* entry = FindEntry(pos);
+    if (entry == NULL)
+        entry = EvictEntry();
+    entry->pos = pos;
+    entry->last_used = ++cache_clock;
+    memcpy(&entry->data, file_data, sizeof(FileData));
+}
+
+// forgets a file, after it was changed without going through the cache
+void CacheDropFile(int pos) {
+    CacheEntry* entry = FindEntry(pos);
+    if (entry != NULL)
+        entry->pos = -1;
+}
+
+// ----------------------------------------------------
+// internal functions
+// ----------------------------------------------------
+
+static CacheEntry* FindEntry(int pos) {
+    for (int i = 0; i < CACHE_FILES; i++)
+        if (cache_entries[i].pos == pos)
+            return &cache_entries[i];
+    return NULL;
+}
+
+/*
+    ---
+    Returns an empty entry or the least recently used one that's already in flash
+    ---
+    saver has less jobs than the cache has entries, so there's always one to take
+*/
+static CacheEntry* EvictEntry() {
+    CacheEntry* oldest = NULL;
+    for (int i = 0; i < CACHE_FILES; i++) {
+        CacheEntry* entry = &cache_entries[i];
+        if (entry->pos == -1)
+            return entry;
+        if (FileSavePending(entry->pos))
+            continue;
+        if (oldest == NULL || entry->last_used < oldest->last_used)
+            oldest = entry;
+    }
+    return oldest;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "files.h"
+
+void CacheInitialize();
+int CacheGetFile(FileData* file_data, int pos);
+int CachePeekFile(FileData* file_data, int pos);
+void CachePutFile(const FileData* file_data, int pos);
+void CacheDropFile(int pos);
@@ -0,0 +1,213 @@
+#include <string.h>
+#include "codec.h"
+#include "files.h"
+
+/*
+    Text codec for file contents
+
+    Bytes are coded with LZSS:
+    - literal: flag 0 followed by a 7-bit code, printable ' '-'}' take codes 0-93
+      and 94 escapes any other byte, which follows in 8 bits
+    - match: flag 1 followed by a 10-bit distance and a 4-bit length (3-18 bytes)
+
+    Matches are found through a hash of the next 3 bytes with a short chain,
+    so encoding stays cheap on a Cortex-M0+ without a divider.
+*/
+
+#define MAX_INPUT (DATA_SIZE)
+
+#define CODE_BITS (7)
+#define CODE_ESCAPE (94)
+#define WINDOW_BITS (10)
+#define WINDOW_SIZE (1 << WINDOW_BITS)
+#define LENGTH_BITS (4)
+#define MIN_MATCH (3)
+#define MAX_MATCH (MIN_MATCH + (1 << LENGTH_BITS) - 1)
+
+#define HASH_SIZE (1024)
+// candidates checked for every position, more gives longer matches but slower saves
+#define MAX_CHAIN (16)
+#define HASH(p) ((((p)[0] << 6) ^ ((p)[1] << 3) ^ (p)[2]) & (HASH_SIZE - 1))
+
+typedef struct BitStream {
+    uint8_t* bytes;
+    int size;
+    int pos;                // next byte
+    uint32_t bits;          // not yet written (or not yet used) bits
+    int amount;             // amount of them
+} BitStream;
+
+// newest position for every hash and previous position with the same hash
+int16_t hash_head[HASH_SIZE];
+int16_t hash_prev[MAX_INPUT];
+
+// CRC-32 (reflected, polynomial 0xEDB88320) of every nibble
+const uint32_t crc_table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+// internal functions
+static int PutBits(BitStream* stream, uint32_t value, int amount);
+static int FlushBits(BitStream* stream);
+static int GetBits(BitStream* stream, int amount);
+static int PutLiteral(BitStream* stream, uint8_t symbol);
+
+// ----------------------------------------------------
+// functions exposed in the header file
+// ----------------------------------------------------
+
+/*
+    ---
+    Encodes 'len' bytes (up to DATA_SIZE)
+    ---
+    returns length of the encoded data or -1 if it didn't fit in 'size' bytes
+*/
+int EncodeBytes(const uint8_t* in, int len, uint8_t* out, int size) {
+    if (len > MAX_INPUT)
+        return -1;
+
+    BitStream stream = { out, size, 0, 0, 0 };
+    for (int i = 0; i < HASH_SIZE; i++)
+        hash_head[i] = -1;
+
+    int pos = 0;
+    while (pos < len) {
+        int best_length = 0;
+        int best_distance = 0;
+        if (pos + MIN_MATCH <= len) {
+            const int limit = len - pos < MAX_MATCH ? len - pos : MAX_MATCH;
+            int candidate = hash_head[HASH(&in[pos])];
+            for (int i = 0; i < MAX_CHAIN && candidate >= 0 && pos - candidate <= WINDOW_SIZE; i++) {
+                int length = 0;
+                while (length < limit && in[candidate + length] == in[pos + length])
+                    length++;
+                if (length > best_length) {
+                    best_length = length;
+                    best_distance = pos - candidate;
+                    if (length == limit)
+                        break;
+                }
+                candidate = hash_prev[candidate];
+            }
+        }
+
+        int step = 1;
+        if (best_length >= MIN_MATCH) {
+            if (PutBits(&stream, 1, 1) < 0
+                || PutBits(&stream, best_distance - 1, WINDOW_BITS) < 0
+                || PutBits(&stream, best_length - MIN_MATCH, LENGTH_BITS) < 0)
+                return -1;
+            step = best_length;
+        } else if (PutLiteral(&stream, in[pos]) < 0) {
+            return -1;
+        }
+
+        // every covered position can be matched later
+        for (int i = 0; i < step; i++, pos++) {
+            if (pos + MIN_MATCH > len)
+                continue;
+            const int hash = HASH(&in[pos]);
+            hash_prev[pos] = hash_head[hash];
+            hash_head[hash] = pos;
+        }
+    }
+    if (FlushBits(&stream) < 0)
+        return -1;
+    return stream.pos;
+}
+
+/*
+    ---
+    Decodes exactly 'size' bytes encoded by EncodeBytes()
+    ---
+    returns -1 if the data is malformed and 0 on success
+*/
+int DecodeBytes(const uint8_t* in, int len, uint8_t* out, int size) {
+    BitStream stream = { (uint8_t*)in, len, 0, 0, 0 };
+    int count = 0;
+    while (count < size) {
+        const int flag = GetBits(&stream, 1);
+        if (flag < 0)
+            return -1;
+
+        if (flag) {
+            const int distance = GetBits(&stream, WINDOW_BITS) + 1;
+            const int length = GetBits(&stream, LENGTH_BITS) + MIN_MATCH;
+            if (distance <= 0 || length < MIN_MATCH || distance > count || count + length > size)
+                return -1;
+            // source can overlap the copy, so it goes byte by byte
+            for (int i = 0; i < length; i++, count++)
+                out[count] = out[count - distance];
+        } else {
+            const int code = GetBits(&stream, CODE_BITS);
+            int symbol;
+            if (code < 0)
+                return -1;
+            else if (code == CODE_ESCAPE)
+                symbol = GetBits(&stream, 8);
+            else
+                symbol = code + ' ';
+            if (symbol < 0)
+                return -1;
+            out[count++] = symbol;
+        }
+    }
+    return 0;
+}
+
+// continues a CRC-32, starting value is 0
+uint32_t Crc32(uint32_t crc, const uint8_t* data, int len) {
+    crc = ~crc;
+    for (int i = 0; i < len; i++) {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ crc_table[crc & 0x0F];
+        crc = (crc >> 4) ^ crc_table[crc & 0x0F];
+    }
+    return ~crc;
+}
+
+// ----------------------------------------------------
+// internal functions
+// ----------------------------------------------------
+
+// bits go out from the most significant one, returns -1 when the buffer is full
+static int PutBits(BitStream* stream, uint32_t value, int amount) {
+    stream->bits = stream->bits << amount | (value & ((1u << amount) - 1));
+    stream->amount += amount;
+    while (stream->amount >= 8) {
+        if (stream->pos == stream->size)
+            return -1;
+        stream->amount -= 8;
+        stream->bytes[stream->pos++] = stream->bits >> stream->amount;
+    }
+    return 0;
+}
+
+// writes out the last partial byte, padded with zeros
+static int FlushBits(BitStream* stream) {
+    if (stream->amount == 0)
+        return 0;
+    return PutBits(stream, 0, 8 - stream->amount);
+}
+
+// returns -1 when the data ends too early
+static int GetBits(BitStream* stream, int amount) {
+    while (stream->amount < amount) {
+        if (stream->pos == stream->size)
+            return -1;
+        stream->bits = stream->bits << 8 | stream->bytes[stream->pos++];
+        stream->amount += 8;
+    }
+    stream->amount -= amount;
+    return (stream->bits >> stream->amount) & ((1u << amount) - 1);
+}
+
+// codes are below 128, so the flag bit (0) is written along with them
+static int PutLiteral(BitStream* stream, uint8_t symbol) {
+    if (symbol >= ' ' && symbol <= '}')
+        return PutBits(stream, symbol - ' ', CODE_BITS + 1);
+    if (PutBits(stream, CODE_ESCAPE, CODE_BITS + 1) < 0)
+        return -1;
+    return PutBits(stream, symbol, 8);
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <inttypes.h>
+
+int EncodeBytes(const uint8_t* in, int len, uint8_t* out, int size);
+int DecodeBytes(const uint8_t* in, int len, uint8_t* out, int size);
+uint32_t Crc32(uint32_t crc, const uint8_t* data, int len);
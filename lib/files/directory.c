@@ -0,0 +1,222 @@
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+#include "directory.h"
+#include "store.h"
+#include "flash.h"
+
+/*
+    Directory journal
+
+    File names are kept as an append-only journal of 32-byte records,
+    so creating, renaming or deleting a file programs a single record
+    instead of erasing the names sector.
+
+    Journal lives in one of two sectors at a time. When it fills up, a snapshot
+    of all names is written to the other sector and its header goes last,
+    so the old journal stays valid until the new one is complete.
+    Sector with the bigger generation wins at boot.
+
+    Before the first change v1.0 names (64 raw 16-byte rows in the names sector) are read as they are.
+*/
+
+#define JOURNAL_MAGIC (0x4A4E5201) // first byte is never found in v1.0 names
+#define RECORD_SIZE (32)
+// first record of a sector is taken by the header
+#define RECORDS_PER_SECTOR (FLASH_SECTOR_SIZE / RECORD_SIZE)
+#define ERASED_OP (0xFF)
+
+typedef struct JournalHeader {
+    uint32_t magic;
+    uint32_t generation;        // bigger in every new snapshot
+    uint8_t reserved[RECORD_SIZE - 8];
+} JournalHeader;
+
+typedef struct JournalRecord {
+    uint8_t op;                 // DirectoryOperation
+    uint8_t slot;
+    uint8_t length;
+    uint8_t check;              // tells apart records cut off by a reset
+    char name[LINE_SIZE];
+    uint8_t reserved[RECORD_SIZE - 4 - LINE_SIZE];
+} JournalRecord;
+
+// sector holding the journal (-1 while v1.0 names are used)
+int journal_sector = -1;
+uint32_t journal_generation = 0;
+// position of the next record in the journal sector
+int journal_next = RECORDS_PER_SECTOR;
+// other sector is known to be erased, so compaction doesn't have to wait for an erase
+int journal_spare_erased = 0;
+
+// internal functions
+static inline const uint8_t* SectorAt(int sector);
+static uint8_t RecordCheck(const JournalRecord* record);
+static void MakeRecord(JournalRecord* record, const FilesInfo* files_info, DirectoryOperation op, int pos);
+static void LoadLegacy(FilesInfo* files_info);
+
+// ----------------------------------------------------
+// functions exposed in the header file
+// ----------------------------------------------------
+
+// rebuilds the names table by replaying the newest journal
+void DirectoryLoad(FilesInfo* files_info) {
+    journal_sector = -1;
+    journal_spare_erased = 0;
+    journal_generation = 0;
+    journal_next = RECORDS_PER_SECTOR;
+
+    const int candidates[2] = { NAMES_SECTOR, JOURNAL_SECTOR };
+    for (int i = 0; i < 2; i++) {
+        const JournalHeader* header = (const JournalHeader*)SectorAt(candidates[i]);
+        if (header->magic == JOURNAL_MAGIC && (journal_sector == -1 || header->generation > journal_generation)) {
+            journal_sector = candidates[i];
+            journal_generation = header->generation;
+        }
+    }
+    if (journal_sector == -1) {
+        LoadLegacy(files_info);
+        return;
+    }
+
+    for (int i = 0; i < AMOUNT_OF_FILES; i++) {
+        memset(files_info->file_names[i], 0xFF, LINE_SIZE);
+        files_info->name_lengths[i] = 0;
+    }
+    const JournalRecord* records = (const JournalRecord*)SectorAt(journal_sector);
+    int i = 1;
+    // records cut off by a reset are skipped, next ones are appended after them
+    for (; i < RECORDS_PER_SECTOR && records[i].op != ERASED_OP; i++) {
+        const JournalRecord* record = &records[i];
+        if (record->check != RecordCheck(record) || record->slot >= AMOUNT_OF_FILES || record->length > LINE_SIZE)
+            continue;
+
+        char* name = files_info->file_names[record->slot];
+        switch (record->op) {
+        case DirectoryCreate:
+        case DirectoryRename:
+            memset(name, 0xFF, LINE_SIZE);
+            memcpy(name, record->name, record->length);
+            files_info->name_lengths[record->slot] = record->length;
+            break;
+        case DirectoryDelete:
+            memset(name, 0xFF, LINE_SIZE);
+            files_info->name_lengths[record->slot] = 0;
+            break;
+        default:
+            break;
+        }
+    }
+    journal_next = i;
+}
+
+/*
+    ---
+    Records a change of a single file name
+    ---
+    name is taken from 'files_info', which already has to hold the change
+    costs one page program, or a snapshot when the journal is full
+*/
+void DirectoryAppend(const FilesInfo* files_info, DirectoryOperation op, int pos) {
+    if (journal_sector == -1 || journal_next >= RECORDS_PER_SECTOR) {
+        DirectoryCompact(files_info);
+        return;
+    }
+    JournalRecord record;
+    MakeRecord(&record, files_info, op, pos);
+    ProgramBytes(journal_sector * FLASH_SECTOR_SIZE + journal_next * RECORD_SIZE, (const uint8_t*)&record, RECORD_SIZE);
+    journal_next++;
+}
+
+/*
+    ---
+    Writes all names as a new journal in the other sector
+    ---
+    header is programmed last, so a reset in the middle leaves the old journal in use
+*/
+void DirectoryCompact(const FilesInfo* files_info) {
+    static JournalRecord records[AMOUNT_OF_FILES];
+    const int sector = journal_sector == JOURNAL_SECTOR ? NAMES_SECTOR : JOURNAL_SECTOR;
+
+    int count = 0;
+    for (int i = 0; i < AMOUNT_OF_FILES; i++)
+        if (files_info->name_lengths[i] > 0)
+            MakeRecord(&records[count++], files_info, DirectoryCreate, i);
+
+    if (!SectorErased(sector))
+        EraseSector(sector);
+    ProgramBytes(sector * FLASH_SECTOR_SIZE + RECORD_SIZE, (const uint8_t*)records, count * RECORD_SIZE);
+    JournalHeader header = { JOURNAL_MAGIC, journal_generation + 1 };
+    memset(header.reserved, 0xFF, sizeof(header.reserved));
+    ProgramBytes(sector * FLASH_SECTOR_SIZE, (const uint8_t*)&header, sizeof(header));
+
+    journal_sector = sector;
+    journal_generation = header.generation;
+    journal_next = count + 1;
+    journal_spare_erased = 0;
+}
+
+/*
+    ---
+    Erases the sector the next compaction goes to
+    ---
+    meant for idle time, nothing is done while v1.0 names are in use (they live in that sector)
+    returns 1 if the sector had to be erased and 0 otherwise
+*/
+int DirectoryPrepare() {
+    if (journal_sector == -1 || journal_spare_erased)
+        return 0;
+    const int sector = journal_sector == JOURNAL_SECTOR ? NAMES_SECTOR : JOURNAL_SECTOR;
+    const int erase = !SectorErased(sector);
+    if (erase)
+        EraseSector(sector);
+    journal_spare_erased = 1;
+    return erase;
+}
+
+// erases both journal sectors, which leaves every file without a name
+void DirectoryFormat() {
+    EraseSector(NAMES_SECTOR);
+    EraseSector(JOURNAL_SECTOR);
+    journal_sector = -1;
+    journal_generation = 0;
+    journal_next = RECORDS_PER_SECTOR;
+    journal_spare_erased = 0;
+}
+
+// ----------------------------------------------------
+// internal functions
+// ----------------------------------------------------
+
+static inline const uint8_t* SectorAt(int sector) {
+    return (const uint8_t*)(XIP_BASE + PERSISTENT_OFFSET + sector * FLASH_SECTOR_SIZE);
+}
+
+static uint8_t RecordCheck(const JournalRecord* record) {
+    uint8_t check = 0x5A ^ record->op ^ record->slot ^ record->length;
+    for (int i = 0; i < LINE_SIZE; i++)
+        check = (check << 1 | check >> 7) ^ record->name[i];
+    return check;
+}
+
+static void MakeRecord(JournalRecord* record, const FilesInfo* files_info, DirectoryOperation op, int pos) {
+    memset(record, 0xFF, sizeof(JournalRecord));
+    record->op = op;
+    record->slot = pos;
+    record->length = op == DirectoryDelete ? 0 : files_info->name_lengths[pos];
+    memcpy(record->name, files_info->file_names[pos], record->length);
+    record->check = RecordCheck(record);
+}
+
+// reads v1.0 names, stored as rows ended by the first 0xFF
+static void LoadLegacy(FilesInfo* files_info) {
+    const uint8_t* names = SectorAt(NAMES_SECTOR);
+    for (int i = 0; i < AMOUNT_OF_FILES; i++) {
+        memcpy(files_info->file_names[i], &names[i * LINE_SIZE], LINE_SIZE);
+
+        int len = 0;
+        while (len < LINE_SIZE && files_info->file_names[i][len] != (char)0xFF)
+            len++;
+        files_info->name_lengths[i] = len;
+    }
+}
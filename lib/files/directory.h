@@ -0,0 +1,15 @@
+#pragma once
+
+#include "files.h"
+
+typedef enum DirectoryOperation {
+    DirectoryCreate = 1,
+    DirectoryRename,
+    DirectoryDelete
+} DirectoryOperation;
+
+void DirectoryLoad(FilesInfo* files_info);
+void DirectoryAppend(const FilesInfo* files_info, DirectoryOperation op, int pos);
+void DirectoryCompact(const FilesInfo* files_info);
+int DirectoryPrepare();
+void DirectoryFormat();
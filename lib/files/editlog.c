@@ -0,0 +1,544 @@
+#include <string.h>
+#include "pico/stdlib.h"
+#include "pico/mutex.h"
+#include "hardware/flash.h"
+#include "editlog.h"
+#include "saver.h"
+#include "store.h"
+#include "flash.h"
+#include "codec.h"
+#include "format.h"
+
+/*
+    Edit log
+
+    Changes made in the editor are appended to a log in flash as they happen,
+    so an unsaved file can be rebuilt after a reset by replaying the log
+    onto the version it was opened from.
+
+    Records work on whole lines: new contents of a line, a line inserted or a line deleted.
+    They're gathered in RAM first, changes to the same line in a row only keep the newest one,
+    and go to flash when the editor is idle or when enough of them pile up.
+
+    Log takes turns between two sectors, every opened file starts a new session in the other one
+    with its first records. The other sector is erased ahead of time on core1 (see EditLogPrepare()),
+    so the editor only programs flash, and records wait in RAM (or only in the copy of the file, see below)
+    instead of waiting for a save that holds the store.
+    Log keeps its own copy of the file with every record applied, the editor only hands over changed lines.
+    When a sector fills up (or records were dropped while they couldn't be written), that copy is written
+    to one of the edit log slots of the store (the one the current session doesn't use)
+    and a new session continues from it. Checkpoints are only made in idle time and never collect garbage,
+    until there's room for one the records wait in the copy.
+    Header of a session tells the store versions it builds on, once the file is saved
+    (or changed in any other way) the log no longer matches and is ignored.
+*/
+
+#define EDITLOG_MAGIC (0x45444C31)
+#define RECORD_SIZE (20)
+// first record of a sector is taken by the header
+#define RECORDS_PER_SECTOR (FLASH_SECTOR_SIZE / RECORD_SIZE)
+// records gathered in RAM before they have to be written
+#define PENDING_RECORDS (16)
+// time without any changes after which gathered records are written
+#define IDLE_FLUSH_US (500 * 1000)
+
+typedef enum EditOperation {
+    EditSetLine = 1,
+    EditInsertLine,         // lines from 'line' move down, last one is dropped
+    EditDeleteLine,         // lines after 'line' move up, last one is cleared
+    EditStop                // file was closed without saving
+} EditOperation;
+
+typedef struct EditLogHeader {
+    uint32_t magic;
+    uint32_t generation;    // bigger in every new session
+    uint32_t base;          // store version of the file the edits go on top of
+    uint32_t checkpoint;    // store version of the checkpoint the session starts from (0 if it starts from the file)
+    uint8_t slot;
+    uint8_t check;
+    uint8_t checkpoint_slot;    // counted from EDITLOG_SLOT
+    uint8_t reserved;
+} EditLogHeader;
+
+typedef struct EditRecord {
+    uint8_t op;             // EditOperation
+    uint8_t line;
+    uint8_t length;
+    uint8_t check;          // tells apart records cut off by a reset
+    char data[LINE_SIZE];
+} EditRecord;
+
+// guards the store, see files.c
+extern recursive_mutex_t files_mutex;
+
+// sector holding the current session (-1 when there's none)
+int log_sector = -1;
+uint32_t log_generation = 0;
+// position of the next record in the log sector
+int log_next = RECORDS_PER_SECTOR;
+// copy of the file being logged with all records applied, checkpoints are made from it
+FileData log_copy;
+// set while a file is being logged, 'log_slot' is its index
+int log_active = 0;
+int log_slot = 0;
+// file being logged has a session in flash, it starts with the first records
+int log_started = 0;
+// records didn't fit into RAM while they couldn't be written, they're only in 'log_copy'
+int log_behind = 0;
+// log was recovered (or formatted), before that it's not known which sector is the spare one
+int log_ready = 0;
+// store slot holding the checkpoint of the current session (-1 when there's none)
+int log_checkpoint = -1;
+// other sector is known to be erased, so a new session doesn't have to wait for an erase
+int log_spare_erased = 0;
+// session was closed without saving, its stop record isn't written yet
+int log_stopping = 0;
+// store version the last checkpoint that didn't fit was tried at, it's tried again once the store changes
+uint32_t checkpoint_failed_seq = 1;
+
+EditRecord pending[PENDING_RECORDS];
+int pending_count = 0;
+uint32_t last_change = 0;
+// file packed for a checkpoint
+uint8_t checkpoint_data[MAX_PACKED_SIZE];
+
+// internal functions
+static inline const uint8_t* LogAt(int sector, int record);
+static uint8_t Check(const void* bytes, int len, uint8_t* check);
+static int RecordErased(const EditRecord* record);
+static int SpareSector();
+static int SpareReady();
+static int BaseReady();
+static void AddRecord(EditOperation op, int line, const char* data, int length);
+static void WritePending();
+static void WriteCheckpoint();
+static int WriteStop(int can_erase);
+static void StartSession(int checkpoint_slot);
+static void ApplyRecord(FileData* file_data, const EditRecord* record);
+
+// ----------------------------------------------------
+// functions exposed in the header file
+// ----------------------------------------------------
+
+/*
+    ---
+    Starts logging changes of a file
+    ---
+    nothing is written until the first change, so opening a file doesn't touch flash (or wait for a save)
+    session builds on the version in flash, so it doesn't start while a save of the file is pending
+    lines already marked as changed (like in a file given back by a failed save)
+    are logged right away, so the session matches the file in RAM
+*/
+void EditLogStart(const FileData* file_data, int pos) {
+    pending_count = 0;
+    log_behind = 0;
+    log_started = 0;
+    log_copy = *file_data;
+    log_active = 1;
+    log_slot = pos;
+    for (int i = 0; i < AMOUNT_OF_LINES; i++)
+        if (file_data->dirty_lines[i / 32] & (1u << (i % 32)))
+            EditLogLine(i, file_data->data[i], file_data->line_lengths[i]);
+}
+
+// logs new contents of a line ('length' characters of 'data')
+void EditLogLine(int line, const char* data, int length) {
+    AddRecord(EditSetLine, line, data, length);
+}
+
+// logs an empty line inserted at 'line'
+void EditLogInsertLine(int line) {
+    AddRecord(EditInsertLine, line, NULL, 0);
+}
+
+// logs removal of 'line'
+void EditLogDeleteLine(int line) {
+    AddRecord(EditDeleteLine, line, NULL, 0);
+}
+
+// writes gathered records to flash if they fit, otherwise (or while a save holds the store) they're left to EditLogTask()
+void EditLogFlush() {
+    if (!recursive_mutex_try_enter(&files_mutex, NULL))
+        return;
+    WritePending();
+    recursive_mutex_exit(&files_mutex);
+}
+
+/*
+    ---
+    Ends the session without saving, so it's not replayed after a reset
+    ---
+    stop record is written right away unless a save holds the store, then EditLogTask() does it
+*/
+void EditLogStop() {
+    pending_count = 0;
+    log_behind = 0;
+    if (log_active && log_started)
+        log_stopping = 1;
+    log_active = 0;
+    if (!log_stopping || !recursive_mutex_try_enter(&files_mutex, NULL))
+        return;
+    WriteStop(0);
+    recursive_mutex_exit(&files_mutex);
+}
+
+/*
+    ---
+    Writes gathered records once the editor goes idle
+    ---
+    records that don't fit the log are covered by a checkpoint, which doesn't collect garbage,
+    meant to be called from the main loop, it doesn't wait for a save running on core1
+*/
+void EditLogTask() {
+    const int idle = time_us_32() - last_change >= IDLE_FLUSH_US;
+    if (!log_stopping && (!idle || (pending_count == 0 && !log_behind)))
+        return;
+    if (!recursive_mutex_try_enter(&files_mutex, NULL))
+        return;
+    if (log_stopping)
+        WriteStop(0);
+    if (idle) {
+        WritePending();
+        WriteCheckpoint();
+    }
+    recursive_mutex_exit(&files_mutex);
+}
+
+/*
+    ---
+    Rebuilds the file that was being edited before a reset
+    ---
+    store has to be initialized first
+    returns 1 if there were unsaved changes ('file_data' and 'pos' get the file and logging goes on)
+    and 0 otherwise
+*/
+int EditLogRecover(FileData* file_data, int* pos) {
+    recursive_mutex_enter_blocking(&files_mutex);
+    log_spare_erased = 0;
+    log_sector = -1;
+    log_generation = 0;
+    log_next = RECORDS_PER_SECTOR;
+    log_active = 0;
+    log_started = 0;
+    log_behind = 0;
+    log_stopping = 0;
+    log_checkpoint = -1;
+    pending_count = 0;
+    log_ready = 1;
+
+    for (int i = 0; i < 2; i++) {
+        EditLogHeader header = *(const EditLogHeader*)LogAt(EDITLOG_SECTOR + i, 0);
+        if (header.magic == EDITLOG_MAGIC && Check(&header, sizeof(header), &header.check) == header.check
+            && (log_sector == -1 || header.generation > log_generation)) {
+            log_sector = EDITLOG_SECTOR + i;
+            log_generation = header.generation;
+        }
+    }
+    if (log_sector == -1) {
+        recursive_mutex_exit(&files_mutex);
+        return 0;
+    }
+
+    // file (or the checkpoint) changed since the session started
+    const EditLogHeader* header = (const EditLogHeader*)LogAt(log_sector, 0);
+    const int checkpoint = header->checkpoint != 0 ? EDITLOG_SLOT + header->checkpoint_slot : -1;
+    if (header->slot >= AMOUNT_OF_FILES || StoreVersion(header->slot) != header->base
+        || (checkpoint != -1 && (checkpoint >= STORE_SLOTS || StoreVersion(checkpoint) != header->checkpoint))
+        || GetFileData(file_data, checkpoint != -1 ? checkpoint : header->slot) < 0) {
+        recursive_mutex_exit(&files_mutex);
+        return 0;
+    }
+    // checkpoint isn't what's saved in the file
+    if (checkpoint != -1)
+        MarkLinesDirty(file_data, 0, AMOUNT_OF_LINES-1);
+
+    int replayed = checkpoint != -1;
+    int stopped = 0;
+    int broken = 0;
+    int i = 1;
+    // replay stops at a record cut off by a reset, next ones are appended after it
+    for (; i < RECORDS_PER_SECTOR; i++) {
+        EditRecord record = *(const EditRecord*)LogAt(log_sector, i);
+        if (RecordErased(&record))
+            break;
+        if (broken || Check(&record, sizeof(record), &record.check) != record.check) {
+            broken = 1;
+            continue;
+        }
+        if (record.op == EditStop)
+            stopped = 1;
+        else
+            ApplyRecord(file_data, &record);
+        replayed++;
+    }
+    log_next = i;
+
+    if (stopped || replayed == 0) {
+        recursive_mutex_exit(&files_mutex);
+        return 0;
+    }
+    *pos = header->slot;
+    log_copy = *file_data;
+    log_active = 1;
+    log_started = 1;
+    log_slot = header->slot;
+    log_checkpoint = checkpoint;
+    recursive_mutex_exit(&files_mutex);
+    return 1;
+}
+
+/*
+    ---
+    Erases the sector the next session goes to
+    ---
+    then drops old checkpoints once a session starts from the file instead
+    and ends a closed session that had no room left for its stop record,
+    meant for idle time, nothing is done before the log is recovered
+    returns 1 if there was some work done and 0 otherwise
+*/
+int EditLogPrepare() {
+    if (!log_ready)
+        return 0;
+    if (log_stopping && WriteStop(1))
+        return 1;
+    if (!log_spare_erased) {
+        const int sector = SpareSector();
+        const int erase = !SectorErased(sector);
+        if (erase)
+            EraseSector(sector);
+        log_spare_erased = 1;
+        if (erase)
+            return 1;
+    }
+    // an empty version lets the store collect a checkpoint
+    for (int i = EDITLOG_SLOT; i < STORE_SLOTS && log_started && log_checkpoint == -1; i++)
+        if (StoreSize(i) > 0 && StoreWrite(i, checkpoint_data, 0) == 0)
+            return 1;
+    return 0;
+}
+
+// erases both log sectors, which drops any session
+void EditLogFormat() {
+    recursive_mutex_enter_blocking(&files_mutex);
+    EraseSector(EDITLOG_SECTOR);
+    EraseSector(EDITLOG_SECTOR + 1);
+    log_sector = -1;
+    log_spare_erased = 1;
+    log_generation = 0;
+    log_next = RECORDS_PER_SECTOR;
+    log_active = 0;
+    log_started = 0;
+    log_behind = 0;
+    log_stopping = 0;
+    log_checkpoint = -1;
+    pending_count = 0;
+    log_ready = 1;
+    recursive_mutex_exit(&files_mutex);
+}
+
+// ----------------------------------------------------
+// internal functions
+// ----------------------------------------------------
+
+static inline const uint8_t* LogAt(int sector, int record) {
+    return (const uint8_t*)(XIP_BASE + PERSISTENT_OFFSET + sector * FLASH_SECTOR_SIZE + record * RECORD_SIZE);
+}
+
+// sector the next session goes to
+static int SpareSector() {
+    return log_sector == EDITLOG_SECTOR ? EDITLOG_SECTOR + 1 : EDITLOG_SECTOR;
+}
+
+// returns whether the file in flash is the one being logged, a save of it could still change it
+static int BaseReady() {
+    return !FileSavePending(log_slot);
+}
+
+// returns whether a new session can start without an erase
+static int SpareReady() {
+    if (!log_spare_erased && SectorErased(SpareSector()))
+        log_spare_erased = 1;
+    return log_spare_erased;
+}
+
+// CRC-32 of a header or a record with its check byte erased, cut to 8 bits
+static uint8_t Check(const void* bytes, int len, uint8_t* check) {
+    const uint8_t stored = *check;
+    *check = 0xFF;
+    const uint8_t result = Crc32(0, (const uint8_t*)bytes, len);
+    *check = stored;
+    return result;
+}
+
+static int RecordErased(const EditRecord* record) {
+    const uint8_t* bytes = (const uint8_t*)record;
+    for (int i = 0; i < RECORD_SIZE; i++)
+        if (bytes[i] != 0xFF)
+            return 0;
+    return 1;
+}
+
+static void AddRecord(EditOperation op, int line, const char* data, int length) {
+    if (!log_active)
+        return;
+    last_change = time_us_32();
+
+    EditRecord record;
+    memset(&record, 0xFF, sizeof(EditRecord));
+    record.op = op;
+    record.line = line;
+    record.length = length;
+    if (data != NULL)
+        memcpy(record.data, data, length);
+    record.check = Check(&record, sizeof(EditRecord), &record.check);
+    // change is already in the copy, so a checkpoint made from it covers this record too
+    ApplyRecord(&log_copy, &record);
+    if (log_behind)
+        return;
+
+    // typing on a single line only keeps its newest contents
+    if (op == EditSetLine && pending_count > 0
+        && pending[pending_count-1].op == EditSetLine && pending[pending_count-1].line == line) {
+        pending[pending_count-1] = record;
+    } else if (pending_count < PENDING_RECORDS) {
+        pending[pending_count++] = record;
+    } else {
+        // records couldn't be written, from now on they're only in the copy until the next checkpoint
+        log_behind = 1;
+        return;
+    }
+    if (pending_count == PENDING_RECORDS)
+        EditLogFlush();
+}
+
+/*
+    ---
+    Programs gathered records after the last one in the log
+    ---
+    first ones start the session of the file, in the other sector once it's erased
+    and once the file's save landed
+    records that don't fit (or follow dropped ones) are left for WriteCheckpoint()
+*/
+static void WritePending() {
+    if (pending_count == 0 || !log_active || log_behind)
+        return;
+    if (!log_started) {
+        if (!BaseReady() || !SpareReady())
+            return;
+        StartSession(-1);
+    }
+    // last record of the sector is kept for the stop record
+    if (log_next + pending_count >= RECORDS_PER_SECTOR)
+        return;
+    ProgramBytes(log_sector * FLASH_SECTOR_SIZE + log_next * RECORD_SIZE,
+        (const uint8_t*)pending, pending_count * RECORD_SIZE);
+    log_next += pending_count;
+    pending_count = 0;
+}
+
+/*
+    ---
+    Writes the log's copy of the file (which already has every record applied) as a checkpoint
+    ---
+    a new session starts from it, so records left in RAM (or dropped) aren't needed anymore
+    store isn't collected for it, when there's no room it's tried again after the store changes
+    and newer changes only live in RAM meanwhile
+*/
+static void WriteCheckpoint() {
+    if (!log_active || (pending_count == 0 && !log_behind) || store_seq == checkpoint_failed_seq
+        || !BaseReady() || !SpareReady())
+        return;
+    const int slot = log_checkpoint == EDITLOG_SLOT ? EDITLOG_SLOT + 1 : EDITLOG_SLOT;
+    const int len = PackFile(&log_copy, checkpoint_data, MAX_PACKED_SIZE);
+    if (StoreTryWrite(slot, checkpoint_data, len) < 0) {
+        checkpoint_failed_seq = store_seq;
+        return;
+    }
+    StartSession(slot);
+    pending_count = 0;
+    log_behind = 0;
+}
+
+/*
+    ---
+    Ends the closed session with a stop record
+    ---
+    records always leave room for it, only a session recovered from an older version can be full,
+    then it goes away with its sector, which is only done if 'can_erase' is set
+    returns 1 if the session was ended and 0 otherwise
+*/
+static int WriteStop(int can_erase) {
+    if (log_next < RECORDS_PER_SECTOR) {
+        EditRecord record;
+        memset(&record, 0xFF, sizeof(record));
+        record.op = EditStop;
+        record.check = Check(&record, sizeof(record), &record.check);
+        ProgramBytes(log_sector * FLASH_SECTOR_SIZE + log_next * RECORD_SIZE, (const uint8_t*)&record, RECORD_SIZE);
+        log_next++;
+    } else if (can_erase) {
+        EraseSector(log_sector);
+    } else {
+        return 0;
+    }
+    log_stopping = 0;
+    return 1;
+}
+
+/*
+    ---
+    Puts a header into the other log sector
+    ---
+    parameter 'checkpoint_slot' is the store slot the session starts from (-1 if it starts from the file)
+    sector has to be erased already, old session stays valid until the header is written
+*/
+static void StartSession(int checkpoint_slot) {
+    const int sector = SpareSector();
+    EditLogHeader header = { EDITLOG_MAGIC, log_generation + 1, StoreVersion(log_slot), 0, log_slot, 0xFF, 0xFF, 0xFF };
+    if (checkpoint_slot != -1) {
+        header.checkpoint = StoreVersion(checkpoint_slot);
+        header.checkpoint_slot = checkpoint_slot - EDITLOG_SLOT;
+    }
+    header.check = Check(&header, sizeof(header), &header.check);
+
+    ProgramBytes(sector * FLASH_SECTOR_SIZE, (const uint8_t*)&header, sizeof(header));
+    log_sector = sector;
+    log_spare_erased = 0;
+    log_generation = header.generation;
+    log_next = 1;
+    log_started = 1;
+    // old session is replaced, it doesn't have to be stopped anymore
+    log_stopping = 0;
+    // old checkpoints aren't needed anymore when it starts from the file, EditLogPrepare() drops them
+    log_checkpoint = checkpoint_slot;
+}
+
+static void ApplyRecord(FileData* file_data, const EditRecord* record) {
+    const int line = record->line;
+    const int moved = AMOUNT_OF_LINES-1 - line;
+    switch (record->op) {
+    case EditSetLine:
+        if (record->length > LINE_SIZE)
+            return;
+        memset(file_data->data[line], 0xFF, LINE_SIZE);
+        memcpy(file_data->data[line], record->data, record->length);
+        file_data->line_lengths[line] = record->length;
+        MarkLinesDirty(file_data, line, line);
+        break;
+    case EditInsertLine:
+        memmove(file_data->data[line+1], file_data->data[line], moved * LINE_SIZE);
+        memmove(&file_data->line_lengths[line+1], &file_data->line_lengths[line], moved * sizeof(int));
+        memset(file_data->data[line], 0xFF, LINE_SIZE);
+        file_data->line_lengths[line] = 0;
+        MarkLinesDirty(file_data, line, AMOUNT_OF_LINES-1);
+        break;
+    case EditDeleteLine:
+        memmove(file_data->data[line], file_data->data[line+1], moved * LINE_SIZE);
+        memmove(&file_data->line_lengths[line], &file_data->line_lengths[line+1], moved * sizeof(int));
+        memset(file_data->data[AMOUNT_OF_LINES-1], 0xFF, LINE_SIZE);
+        file_data->line_lengths[AMOUNT_OF_LINES-1] = 0;
+        MarkLinesDirty(file_data, line, AMOUNT_OF_LINES-1);
+        break;
+    default:
+        break;
+    }
+}
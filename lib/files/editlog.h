@@ -0,0 +1,14 @@
+#pragma once
+
+#include "files.h"
+
+void EditLogStart(const FileData* file_data, int pos);
+void EditLogLine(int line, const char* data, int length);
+void EditLogInsertLine(int line);
+void EditLogDeleteLine(int line);
+void EditLogFlush();
+void EditLogStop();
+void EditLogTask();
+int EditLogRecover(FileData* file_data, int* pos);
+int EditLogPrepare();
+void EditLogFormat();
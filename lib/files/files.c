@@ -2,122 +2,318 @@
 #include "pico/stdlib.h"
 #include "hardware/flash.h"
 #include "hardware/sync.h"
+#include "pico/mutex.h"
 #include "files.h"
+#include "store.h"
+#include "flash.h"
+#include "directory.h"
+#include "format.h"
+#include "editlog.h"
 #include <stdlib.h>
 
 
-// sizes used for erasing (memory supports erasing of 4KB, 32KB, 64KB or entire chip)
-#define ERASE_DATA_SIZE (64 * 1024) // 64KB for 64 1KB files
-#define ERASE_NAMES_SIZE FLASH_SECTOR_SIZE // 1KB for 64 16-byte file names (it's reserved as whole 4K sector because apparently SDK can only do sector-level erasing)
+// flash work done by the last save and by all of them together
+SaveStats last_save, total_saves;
+// packed file on its way to (or from) the store
+uint8_t packed_data[MAX_PACKED_SIZE];
+// saves run on core1 (see saver.c), every function touching the store or the directory holds it
+recursive_mutex_t files_mutex;
 
-#define DATA_SECTOR_SIZE (ERASE_DATA_SIZE)
-#define NAMES_SECTOR_SIZE (1024)
+// internal functions
+static int MapFileData(FileData* file_data, int pos);
+static int MapMayContain(int pos, const char* pattern, int len);
+static void ClearDirty(FileData* file_data);
 
-#define FLASH_DATA_OFFSET (2048 * 1024 - ERASE_DATA_SIZE)
-#define FLASH_NAMES_OFFSET (2048 * 1024 - ERASE_DATA_SIZE - ERASE_NAMES_SIZE) 
+// reads the store index from flash, has to be called before accessing any file
+void InitializeFiles() {
+    recursive_mutex_init(&files_mutex);
+    StoreInitialize();
+}
 
-const uint8_t *flash_data_contents = (const uint8_t *) (XIP_BASE + FLASH_DATA_OFFSET);
-const uint8_t *flash_names_contents = (const uint8_t *) (XIP_BASE + FLASH_NAMES_OFFSET);
+/*
+    ---
+    Does background work of the file store
+    ---
+    keeps erased sectors ready, so saves, directory changes and new edit log sessions
+    only have to program flash, one erase at a time, so new input doesn't wait for long
+    an erase stops both cores, so nothing is done until the keyboard was idle for a while
+    meant to be called when there's nothing else to do,
+    returns 1 if there was some work done and 0 otherwise
+*/
+int FilesTask() {
+    if (!FlashIdle())
+        return 0;
+    recursive_mutex_enter_blocking(&files_mutex);
+    FlashBackground(1);
+    int done = StoreNeedsCollecting() && StoreCollect();
+    if (!done)
+        done = DirectoryPrepare();
+    if (!done)
+        done = EditLogPrepare();
+    FlashBackground(0);
+    recursive_mutex_exit(&files_mutex);
+    return done;
+}
 
+// replays the directory journal, file sizes come from the store
 void GetFilesInfo(FilesInfo* files_info) {
+    recursive_mutex_enter_blocking(&files_mutex);
+    DirectoryLoad(files_info);
+    for (int i = 0; i < AMOUNT_OF_FILES; i++)
+        files_info->file_sizes[i] = StoreSize(i);
+    recursive_mutex_exit(&files_mutex);
+}
 
-    // for every file
-    for (int i = 0; i < AMOUNT_OF_FILES; i++) {
-        // Copy data into the struct
-        memcpy(files_info->file_names[i],
-            &flash_names_contents[i * LINE_SIZE],
-            LINE_SIZE);
-
-        int len = 0;
-        // Increase len until it hits the name size or an empty memory byte appears
-        while (len < LINE_SIZE)
-            if (files_info->file_names[i][len] == 0xFF)
-                break;
-            else
-                len++;
-        // set file length inside struct
-        files_info->name_lengths[i] = len;
-    }}
-
-void GetFileData(FileData* file_data, int pos) {
-    for (int i = 0; i < AMOUNT_OF_LINES; i++) {
-        memcpy(file_data->data[i],
-            &flash_data_contents[pos*DATA_SIZE + i*LINE_SIZE],
-            LINE_SIZE);
-        
-        int len = 0;
-        while (len < LINE_SIZE) {
-            if (file_data->data[i][len] == 0xFF)
-                break;
-            else
-                len++;
+/*
+    ---
+    Loads a file into RAM
+    ---
+    v2 files are checked and copied line by line, v1 rows (v1.0 files) are scanned for 0xFF
+    v2 file kept in one piece is unpacked straight from flash, only a split one is gathered in RAM first
+    while a save on core1 holds the store, a file kept in one piece is still read without waiting for it
+    returns -1 if the file is damaged (it's loaded as empty) and 0 on success
+*/
+int GetFileData(FileData* file_data, int pos) {
+    while (!recursive_mutex_try_enter(&files_mutex, NULL)) {
+        const int mapped = MapFileData(file_data, pos);
+        if (mapped > 0)
+            return 0;
+        if (mapped < 0) {
+            recursive_mutex_enter_blocking(&files_mutex);
+            break;
+        }
+    }
+    int result = 0;
+    int mapped_size;
+    const uint8_t* mapped = StoreMap(pos, &mapped_size);
+    if (mapped != NULL && mapped_size > 0 && mapped[0] == FORMAT_VERSION && UnpackFile(mapped, mapped_size, file_data) == 0) {
+        ClearDirty(file_data);
+        recursive_mutex_exit(&files_mutex);
+        return 0;
+    }
+
+    // store gives back 0xFF for bytes that weren't saved
+    const int size = StoreRead(pos, packed_data, MAX_PACKED_SIZE);
+    if (size > 0 && packed_data[0] == FORMAT_VERSION) {
+        result = UnpackFile(packed_data, size, file_data);
+        if (result < 0) {
+            memset(packed_data, 0xFF, DATA_SIZE);
+            UnpackRows(packed_data, 0, file_data);
         }
-        file_data->line_lengths[i] = len;
+    } else {
+        UnpackRows(packed_data, size, file_data);
     }
+    ClearDirty(file_data);
+    recursive_mutex_exit(&files_mutex);
+    return result;
+}
+
+/*
+    ---
+    Tells if a text could be in a file, only by reading the signature saved with it
+    ---
+    files saved before signatures were added (v1.0 files too) can't be told, they always could hold it
+    while a save on core1 holds the store, the signature is read straight from flash without waiting for it,
+    file that can't be read that way could hold it too
+    returns 0 if the file surely doesn't have the text (or it's empty) and 1 otherwise
+*/
+int FileMayContain(int pos, const char* pattern, int len) {
+    if (!recursive_mutex_try_enter(&files_mutex, NULL))
+        return MapMayContain(pos, pattern, len);
+    uint8_t start[SIGNATURE_END];
+    uint8_t signature[SIGNATURE_SIZE];
+    int result = 1;
+    const int size = StoreRead(pos, start, SIGNATURE_END);
+    if (size == 0)
+        result = 0;
+    else if (ReadSignature(start, size, signature) == 0)
+        result = SignatureMatches(signature, pattern, len);
+    recursive_mutex_exit(&files_mutex);
+    return result;
 }
 
+// writes the whole names table at once, as a fresh journal
 void WriteFilesInfo(FilesInfo* files_info) {
-    uint8_t ints = save_and_disable_interrupts();
-    flash_range_erase(FLASH_NAMES_OFFSET, FLASH_SECTOR_SIZE);
-    flash_range_program(FLASH_NAMES_OFFSET, (char*)files_info->file_names, NAMES_SECTOR_SIZE);
-    restore_interrupts(ints);
-}
-
-void WriteFileData(FileData* file_data, int pos) {
-    const int files_per_sector = FLASH_SECTOR_SIZE / DATA_SIZE;
-    const int current_sector = pos / files_per_sector;
-    const int file_in_sector = pos % files_per_sector;
-    const int sector_offset = FLASH_DATA_OFFSET + current_sector*FLASH_SECTOR_SIZE;
-    // get existing sector data from flash into a buffer
-    char buf[FLASH_SECTOR_SIZE];
-    memcpy(buf,
-        &flash_data_contents[current_sector*FLASH_SECTOR_SIZE],
-        FLASH_SECTOR_SIZE);
-    // put new file data into the buffer
-    char *data_pointer = (char*)file_data->data;
-    memmove(&buf[file_in_sector*DATA_SIZE],
-        data_pointer,
-        DATA_SIZE);
-    // write modified sector to flash
-    uint8_t ints = save_and_disable_interrupts();
-    flash_range_erase(sector_offset, FLASH_SECTOR_SIZE);
-    flash_range_program(sector_offset, buf, FLASH_SECTOR_SIZE);
-    restore_interrupts(ints);
+    recursive_mutex_enter_blocking(&files_mutex);
+    DirectoryCompact(files_info);
+    recursive_mutex_exit(&files_mutex);
 }
 
+/*
+    ---
+    Saves the file if anything changed
+    ---
+    every save is a new version in the v2 format (see format.c), written next to the old one,
+    so a power cut in the middle leaves the previous version (v1.0 files included) intact
+
+    returns -1 when there's not enough space and 0 on success
+*/
+int WriteFileData(FileData* file_data, int pos) {
+    recursive_mutex_enter_blocking(&files_mutex);
+    const StoreCounters before = store_counters;
+    int result = 0;
+
+    if (file_data->dirty) {
+        const int len = PackFile(file_data, packed_data, MAX_PACKED_SIZE);
+        result = StoreWrite(pos, packed_data, len);
+    }
+    if (result == 0)
+        ClearDirty(file_data);
+
+    last_save.bytes_programmed = store_counters.bytes_programmed - before.bytes_programmed;
+    last_save.erases = store_counters.sectors_erased - before.sectors_erased;
+    // saves with nothing to write don't count, they would never have erased anything
+    last_save.erases_avoided = last_save.bytes_programmed != 0 && last_save.erases == 0;
+
+    total_saves.bytes_programmed += last_save.bytes_programmed;
+    total_saves.erases += last_save.erases;
+    total_saves.erases_avoided += last_save.erases_avoided;
+    recursive_mutex_exit(&files_mutex);
+    return result;
+}
+
+// marks lines from 'first' to 'last' (inclusive) as changed
+void MarkLinesDirty(FileData* file_data, int first, int last) {
+    if (first < 0)
+        first = 0;
+    if (last >= AMOUNT_OF_LINES)
+        last = AMOUNT_OF_LINES-1;
+    for (int i = first; i <= last; i++)
+        file_data->dirty_lines[i / 32] |= 1u << (i % 32);
+    if (first <= last)
+        file_data->dirty = 1;
+}
+
+// copies flash work done by the last save and by all saves since boot
+void GetSaveStats(SaveStats* last, SaveStats* total) {
+    recursive_mutex_enter_blocking(&files_mutex);
+    *last = last_save;
+    *total = total_saves;
+    recursive_mutex_exit(&files_mutex);
+}
+
+// copies erase stats, pool depth is the amount of free store sectors right now
+void GetFlashStats(FlashStats* stats) {
+    recursive_mutex_enter_blocking(&files_mutex);
+    *stats = flash_stats;
+    stats->pool_depth = StoreFreeSectors();
+    recursive_mutex_exit(&files_mutex);
+}
+
+// names are only changed in RAM, core1 writes them to the directory (see QueueFileName())
 void CreateFile(FilesInfo* files_info, int pos, char* name, int len) {
     files_info->name_lengths[pos] = len;
     memcpy(files_info->file_names[pos], name, len*sizeof(char));
     for (int i = len; i < LINE_SIZE; i++) {
         files_info->file_names[pos][i] = 255;
     }
+}
 
-    WriteFilesInfo(files_info);
+void RenameFile(FilesInfo* files_info, int pos, char* name, int len) {
+    CreateFile(files_info, pos, name, len);
 }
 
+/*
+    ---
+    Removes a file from the names in RAM
+    ---
+    'file_data' becomes an empty file that still has to be written over the old one,
+    core1 does both (see QueueFileName() and QueueFileDelete())
+*/
 void DeleteFile(FilesInfo* files_info, FileData* file_data, int pos) {
     for (int i = 0; i < LINE_SIZE; i++)
         files_info->file_names[pos][i] = 255;
-    
-    WriteFilesInfo(files_info);
     files_info->name_lengths[pos] = 0;
     
-    for (int i = 0; i < AMOUNT_OF_LINES; i++)
+    for (int i = 0; i < AMOUNT_OF_LINES; i++) {
         for (int j = 0; j < LINE_SIZE; j++)
             file_data->data[i][j] = 255;
+        file_data->line_lengths[i] = 0;
+    }
+    MarkLinesDirty(file_data, 0, AMOUNT_OF_LINES-1);
+    files_info->file_sizes[pos] = 0;
+}
+
+/*
+    ---
+    Records a new name of a file in the directory (empty one deletes it)
+    ---
+    'files_info' holds names as they're in flash and gets the change,
+    costs one page program, or a snapshot of all names when the journal is full
+*/
+void WriteFileName(FilesInfo* files_info, int pos, const char* name, int len) {
+    recursive_mutex_enter_blocking(&files_mutex);
+    const DirectoryOperation op = len == 0 ? DirectoryDelete
+        : files_info->name_lengths[pos] == 0 ? DirectoryCreate : DirectoryRename;
+    files_info->name_lengths[pos] = len;
+    memset(files_info->file_names[pos], 0xFF, LINE_SIZE);
+    memcpy(files_info->file_names[pos], name, len);
 
-    WriteFileData(file_data, pos);
+    DirectoryAppend(files_info, op, pos);
+    recursive_mutex_exit(&files_mutex);
 }
 
 void EraseAll() {
-    const int pages = 68 * 4;
-    uint8_t buf[256];
-    for (int i = 0; i < 256; i++)
-        buf[i] = 0xFF;
-
-    for (int i = 0; i < pages; i++) {
-        flash_range_erase(FLASH_NAMES_OFFSET + i*FLASH_PAGE_SIZE, FLASH_PAGE_SIZE);
-        flash_range_program(FLASH_NAMES_OFFSET + i*FLASH_PAGE_SIZE, buf, FLASH_PAGE_SIZE);   
-    }
-    
+    recursive_mutex_enter_blocking(&files_mutex);
+    DirectoryFormat();
+    StoreFormat();
+    EditLogFormat();
+    recursive_mutex_exit(&files_mutex);
+}
+
+// ----------------------------------------------------
+// internal functions
+// ----------------------------------------------------
+
+/*
+    ---
+    Unpacks a file straight from flash without holding the files mutex
+    ---
+    store can change meanwhile, the file only counts if it didn't (see StoreMap())
+    returns 1 on success, 0 if the store changed and -1 if the file can't be read this way
+*/
+static int MapFileData(FileData* file_data, int pos) {
+    const uint32_t seq = store_seq;
+    if (seq & 1)
+        return 0;
+    __dmb();
+    int mapped_size;
+    const uint8_t* mapped = StoreMap(pos, &mapped_size);
+    const int unpacked = mapped != NULL && mapped_size > 0 && mapped[0] == FORMAT_VERSION
+        && UnpackFile(mapped, mapped_size, file_data) == 0;
+    __dmb();
+    if (store_seq != seq)
+        return 0;
+    if (!unpacked)
+        return -1;
+    ClearDirty(file_data);
+    return 1;
+}
+
+/*
+    ---
+    Tells if a text could be in a file by reading its signature without holding the files mutex
+    ---
+    store can change meanwhile, the signature only counts if it didn't (see StoreMap())
+    returns 0 if the file surely doesn't have the text and 1 otherwise
+*/
+static int MapMayContain(int pos, const char* pattern, int len) {
+    const uint32_t seq = store_seq;
+    if (seq & 1)
+        return 1;
+    __dmb();
+    uint8_t signature[SIGNATURE_SIZE];
+    int mapped_size;
+    const uint8_t* mapped = StoreMap(pos, &mapped_size);
+    const int read = mapped != NULL && ReadSignature(mapped, mapped_size, signature) == 0;
+    __dmb();
+    if (store_seq != seq || !read)
+        return 1;
+    return SignatureMatches(signature, pattern, len);
+}
+
+static void ClearDirty(FileData* file_data) {
+    for (int i = 0; i < AMOUNT_OF_LINES / 32; i++)
+        file_data->dirty_lines[i] = 0;
+    file_data->dirty = 0;
 }
\ No newline at end of file
@@ -1,24 +1,59 @@
 #pragma once
 
+#include <inttypes.h>
+
 #define AMOUNT_OF_FILES (64)
-#define AMOUNT_OF_LINES (64)
+// files only take as much flash as they use, so the limit is just the size of the editing buffer
+#define AMOUNT_OF_LINES (256)
 #define LINE_SIZE (16)
-#define DATA_SIZE (1024)
+#define DATA_SIZE (AMOUNT_OF_LINES * LINE_SIZE)
+// v1.1 saved files as raw 256 byte pages of 16 lines, the compressed format is compared to them
+#define PAGE_SIZE (256)
+#define LINES_PER_PAGE (PAGE_SIZE / LINE_SIZE)
 
 typedef struct FilesInfo {
     char file_names[AMOUNT_OF_FILES][LINE_SIZE];
     int name_lengths[AMOUNT_OF_FILES];
+    // stored bytes of every file (0 if it's empty)
+    int file_sizes[AMOUNT_OF_FILES];
 } FilesInfo;
 
 typedef struct FileData {
     char data[AMOUNT_OF_LINES][LINE_SIZE];
     int line_lengths[AMOUNT_OF_LINES];
+    // lines changed since the file was loaded or saved, one bit each
+    uint32_t dirty_lines[AMOUNT_OF_LINES / 32];
+    // set when any line changed (or flash could still end up with an older version), a save packs and writes the whole file
+    int dirty;
 } FileData;
 
+// flash work done by saves
+typedef struct SaveStats {
+    uint32_t bytes_programmed;
+    uint32_t erases;
+    uint32_t erases_avoided;    // saves that wrote data without erasing a sector
+} SaveStats;
+
+// erases done ahead of time and the longest time flash was taken away from both cores
+typedef struct FlashStats {
+    int pool_depth;             // erased sectors ready for saves
+    uint32_t worst_window_us;   // longest single erase or program, interrupts were off for all of it
+    uint32_t erases_background; // done in idle time
+    uint32_t erases_waited;     // somebody had to wait for them
+} FlashStats;
+
+void InitializeFiles();
+int FilesTask();
 void GetFilesInfo(FilesInfo* files_info);
-void GetFileData(FileData* file_data, int pos);
+int GetFileData(FileData* file_data, int pos);
+int FileMayContain(int pos, const char* pattern, int len);
 void WriteFilesInfo(FilesInfo* files_info);
-void WriteFileData(FileData* file_data, int pos);
+int WriteFileData(FileData* file_data, int pos);
+void MarkLinesDirty(FileData* file_data, int first, int last);
+void GetSaveStats(SaveStats* last, SaveStats* total);
+void GetFlashStats(FlashStats* stats);
 void CreateFile(FilesInfo* files_info, int pos, char* name, int len); 
+void RenameFile(FilesInfo* files_info, int pos, char* name, int len);
 void DeleteFile(FilesInfo* files_info, FileData* file_data, int pos);
+void WriteFileName(FilesInfo* files_info, int pos, const char* name, int len);
 void EraseAll();
\ No newline at end of file
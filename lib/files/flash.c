@@ -0,0 +1,153 @@
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "pico/multicore.h"
+#include "flash.h"
+#include "store.h"
+#include "files.h"
+
+/*
+    Flash access
+
+    Flash can't be read while it's being erased or programmed, so both cores
+    run with interrupts off for that time. A page program takes well under a millisecond,
+    an erase of a sector takes tens of milliseconds and makes the USB host miss keyboard reports.
+
+    Erases are meant to be done ahead of time: files have background work (see FilesTask())
+    which keeps erased sectors ready, and it only runs when no keyboard input was seen for a while.
+    Every erase is counted either as background work or as one somebody had to wait for.
+    Core doing long writes can get work done between single operations (see FlashSetYield()).
+*/
+
+// time without keyboard input after which background erases can run
+#define IDLE_AFTER_US (1000 * 1000)
+
+// input is seen on core0, background work runs on core1
+volatile uint32_t last_input = 0;
+volatile int input_seen = 0;
+// set while background work runs
+int flash_background = 0;
+
+FlashStats flash_stats = { 0 };
+// called after every erase or program done on 'yield_core'
+void (*flash_yield)() = NULL;
+int yield_core = -1;
+
+// internal functions
+static uint32_t FlashBegin();
+static void FlashEnd(uint32_t ints, uint32_t start);
+
+// ----------------------------------------------------
+// functions exposed in the header file
+// ----------------------------------------------------
+
+/*
+    ---
+    Programs bytes at any offset inside the region
+    ---
+    rest of every touched page is programmed with 0xFF, which leaves it unchanged,
+    so the target bytes only have to be erased (data can be also read from flash itself)
+*/
+void ProgramBytes(uint32_t offset, const uint8_t* data, int len) {
+    uint8_t page[FLASH_PAGE_SIZE];
+    while (len > 0) {
+        const uint32_t page_start = offset & ~(FLASH_PAGE_SIZE - 1);
+        const int in_page = offset - page_start;
+        int amount = FLASH_PAGE_SIZE - in_page;
+        if (amount > len)
+            amount = len;
+
+        memset(page, 0xFF, FLASH_PAGE_SIZE);
+        memcpy(&page[in_page], data, amount);
+        const uint32_t start = time_us_32();
+        const uint32_t ints = FlashBegin();
+        flash_range_program(PERSISTENT_OFFSET + page_start, page, FLASH_PAGE_SIZE);
+        FlashEnd(ints, start);
+        store_counters.bytes_programmed += amount;
+
+        offset += amount;
+        data += amount;
+        len -= amount;
+    }
+}
+
+// erases a sector of the region (counted from its start)
+void EraseSector(int sector) {
+    const uint32_t start = time_us_32();
+    const uint32_t ints = FlashBegin();
+    flash_range_erase(PERSISTENT_OFFSET + sector * FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE);
+    FlashEnd(ints, start);
+    store_counters.sectors_erased++;
+    if (flash_background)
+        flash_stats.erases_background++;
+    else
+        flash_stats.erases_waited++;
+}
+
+// checks if a sector of the region is erased, so it can be used without an erase
+int SectorErased(int sector) {
+    const uint32_t* words = (const uint32_t*)(XIP_BASE + PERSISTENT_OFFSET + sector * FLASH_SECTOR_SIZE);
+    for (int i = 0; i < FLASH_SECTOR_SIZE / 4; i++)
+        if (words[i] != 0xFFFFFFFF)
+            return 0;
+    return 1;
+}
+
+// notes keyboard input, background erases wait until it's been idle for a while
+void FlashInputSeen() {
+    last_input = time_us_32();
+    input_seen = 1;
+}
+
+// returns whether background erases can run now
+int FlashIdle() {
+    return !input_seen || time_us_32() - last_input >= IDLE_AFTER_US;
+}
+
+// marks erases from now on as background work (1) or as ones somebody waits for (0)
+void FlashBackground(int background) {
+    flash_background = background;
+}
+
+/*
+    ---
+    Sets a function called after every erase and program done by the calling core
+    ---
+    a save or garbage collection takes many of them, it runs with the files mutex held
+    and interrupts back on, so it shouldn't touch the store
+*/
+void FlashSetYield(void (*yield)()) {
+    yield_core = get_core_num();
+    flash_yield = yield;
+}
+
+// ----------------------------------------------------
+// internal functions
+// ----------------------------------------------------
+
+/*
+    ---
+    Gets flash ready for erase or program
+    ---
+    flash can't be read while it's being written, so interrupts are disabled
+    and the other core (if it's running) is parked in RAM until FlashEnd()
+*/
+static uint32_t FlashBegin() {
+    if (multicore_lockout_victim_is_initialized(get_core_num() ^ 1))
+        multicore_lockout_start_blocking();
+    return save_and_disable_interrupts();
+}
+
+// 'start' is the time taken before FlashBegin(), the other core is parked for all of it
+static void FlashEnd(uint32_t ints, uint32_t start) {
+    restore_interrupts(ints);
+    if (multicore_lockout_victim_is_initialized(get_core_num() ^ 1))
+        multicore_lockout_end_blocking();
+
+    const uint32_t window = time_us_32() - start;
+    if (window > flash_stats.worst_window_us)
+        flash_stats.worst_window_us = window;
+    if (flash_yield != NULL && get_core_num() == yield_core)
+        flash_yield();
+}
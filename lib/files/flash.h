@@ -0,0 +1,14 @@
+#pragma once
+
+#include <inttypes.h>
+#include "files.h"
+
+extern FlashStats flash_stats;
+
+void ProgramBytes(uint32_t offset, const uint8_t* data, int len);
+void EraseSector(int sector);
+int SectorErased(int sector);
+void FlashInputSeen();
+int FlashIdle();
+void FlashBackground(int background);
+void FlashSetYield(void (*yield)());
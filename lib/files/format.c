@@ -0,0 +1,253 @@
+#include <string.h>
+#include "format.h"
+#include "codec.h"
+
+/*
+    On-flash file format
+
+    v2 (written by every save):
+    - header with the format version, line count, text length and CRC-32 of everything after it
+    - signature of the text (v2 files saved before it was added don't have it, a flag tells)
+    - line lengths, 5 bits each
+    - text of all lines joined together, compressed (see codec.c) unless that doesn't make it shorter
+    Loading is a CRC check and a copy of every line, nothing has to be scanned.
+
+    Signature is a bitmap with a bit set for a hash of every 3 characters in a row
+    the text has (trigram), in the same paragraph. Text that has a trigram
+    which isn't set can't be in the file, so a search can skip it only by reading the signature.
+
+    v1 (v1.0 files): 16-byte rows, every line ends at the first 0xFF
+*/
+
+#define LENGTH_BITS (5)
+#define LENGTHS_SIZE(lines) (((lines) * LENGTH_BITS + 7) / 8)
+// trigram hashes pick one of the SIGNATURE_SIZE * 8 bits
+#define SIGNATURE_BITS (8)
+
+typedef enum FormatFlags {
+    FormatCompressed = 1,
+    FormatSignature = 2
+} FormatFlags;
+
+typedef struct FileHeader {
+    uint8_t version;
+    uint8_t flags;
+    uint16_t lines;
+    uint16_t text_length;       // characters in all lines
+    uint16_t stored_length;     // bytes after the header
+    uint32_t crc;               // of the bytes after the header
+} FileHeader;
+
+// lines joined together, files are packed on core1 while core0 unpacks others, so each has its own
+uint8_t text_buffer[DATA_SIZE];
+uint8_t unpacked_text[DATA_SIZE];
+
+// internal functions
+static int LengthAt(const uint8_t* lengths, int line);
+static inline int TrigramBit(uint8_t a, uint8_t b, uint8_t c);
+static void MakeSignature(const FileData* file_data, int lines, uint8_t* signature);
+
+// ----------------------------------------------------
+// functions exposed in the header file
+// ----------------------------------------------------
+
+/*
+    ---
+    Packs a file into the v2 format
+    ---
+    empty lines at the end of the file are not stored
+    returns length of the packed file or -1 if it didn't fit in 'size' bytes
+*/
+int PackFile(const FileData* file_data, uint8_t* out, int size) {
+    int lines = AMOUNT_OF_LINES;
+    while (lines > 0 && file_data->line_lengths[lines-1] == 0)
+        lines--;
+
+    FileHeader header = { FORMAT_VERSION, FormatSignature, lines, 0, 0, 0 };
+    const int lengths_size = LENGTHS_SIZE(lines);
+    if (size < (int)sizeof(header) + SIGNATURE_SIZE + lengths_size)
+        return -1;
+
+    uint8_t* signature = &out[sizeof(header)];
+    MakeSignature(file_data, lines, signature);
+    uint8_t* lengths = &signature[SIGNATURE_SIZE];
+    memset(lengths, 0, lengths_size);
+    for (int i = 0; i < lines; i++) {
+        const int len = file_data->line_lengths[i];
+        memcpy(&text_buffer[header.text_length], file_data->data[i], len);
+        header.text_length += len;
+        for (int bit = 0; bit < LENGTH_BITS; bit++)
+            if (len & (1 << bit))
+                lengths[(i * LENGTH_BITS + bit) / 8] |= 1 << ((i * LENGTH_BITS + bit) % 8);
+    }
+
+    // compressed text is only kept if it's shorter
+    uint8_t* body = &lengths[lengths_size];
+    const int room = size - sizeof(header) - SIGNATURE_SIZE - lengths_size;
+    int body_length = -1;
+    if (header.text_length > 0) {
+        body_length = EncodeBytes(text_buffer, header.text_length, body,
+            room < header.text_length ? room : header.text_length - 1);
+        if (body_length >= 0)
+            header.flags |= FormatCompressed;
+    }
+    if (body_length < 0) {
+        if (header.text_length > room)
+            return -1;
+        memcpy(body, text_buffer, header.text_length);
+        body_length = header.text_length;
+    }
+
+    header.stored_length = SIGNATURE_SIZE + lengths_size + body_length;
+    header.crc = Crc32(0, signature, header.stored_length);
+    memcpy(out, &header, sizeof(header));
+    return sizeof(header) + header.stored_length;
+}
+
+/*
+    ---
+    Unpacks a v2 file into RAM
+    ---
+    'file_data' is left unchanged when the file doesn't pass the checks
+    returns -1 if the file is damaged and 0 on success
+*/
+int UnpackFile(const uint8_t* in, int len, FileData* file_data) {
+    FileHeader header;
+    if (len < (int)sizeof(header))
+        return -1;
+    memcpy(&header, in, sizeof(header));
+    const int signature_size = header.flags & FormatSignature ? SIGNATURE_SIZE : 0;
+    const uint8_t* lengths = &in[sizeof(header) + signature_size];
+    const int lengths_size = LENGTHS_SIZE(header.lines);
+    if (header.version != FORMAT_VERSION || header.lines > AMOUNT_OF_LINES || header.text_length > DATA_SIZE
+        || header.stored_length > len - (int)sizeof(header) || header.stored_length < signature_size + lengths_size
+        || Crc32(0, &in[sizeof(header)], header.stored_length) != header.crc)
+        return -1;
+
+    int text_length = 0;
+    for (int i = 0; i < header.lines; i++) {
+        const int line_length = LengthAt(lengths, i);
+        if (line_length > LINE_SIZE)
+            return -1;
+        text_length += line_length;
+    }
+    if (text_length != header.text_length)
+        return -1;
+
+    const uint8_t* body = &lengths[lengths_size];
+    const int body_length = header.stored_length - signature_size - lengths_size;
+    const uint8_t* text = body;
+    if (header.flags & FormatCompressed) {
+        if (DecodeBytes(body, body_length, unpacked_text, text_length) < 0)
+            return -1;
+        text = unpacked_text;
+    } else if (body_length != text_length) {
+        return -1;
+    }
+
+    for (int i = 0; i < AMOUNT_OF_LINES; i++) {
+        const int line_length = i < header.lines ? LengthAt(lengths, i) : 0;
+        memcpy(file_data->data[i], text, line_length);
+        memset(&file_data->data[i][line_length], 0xFF, LINE_SIZE - line_length);
+        file_data->line_lengths[i] = line_length;
+        text += line_length;
+    }
+    return 0;
+}
+
+// loads a v1 file, stored as 16-byte rows padded with 0xFF (which 'in' is expected to be padded with too)
+void UnpackRows(const uint8_t* in, int len, FileData* file_data) {
+    memcpy(file_data->data, in, DATA_SIZE);
+    const int stored_lines = (len + LINE_SIZE - 1) / LINE_SIZE;
+    for (int i = 0; i < AMOUNT_OF_LINES; i++) {
+        int line_length = 0;
+        // lines past the stored size are empty
+        if (i >= stored_lines) {
+            file_data->line_lengths[i] = 0;
+            continue;
+        }
+        while (line_length < LINE_SIZE) {
+            if (file_data->data[i][line_length] == 0xFF)
+                break;
+            else
+                line_length++;
+        }
+        file_data->line_lengths[i] = line_length;
+    }
+}
+
+/*
+    ---
+    Copies the signature of a v2 file
+    ---
+    only the start of the file is needed (SIGNATURE_END bytes), it isn't checked against the CRC,
+    a damaged signature only makes a search look into a file it could skip or skip one it shouldn't
+    returns -1 if the file doesn't have one and 0 on success
+*/
+int ReadSignature(const uint8_t* in, int len, uint8_t* signature) {
+    FileHeader header;
+    if (len < SIGNATURE_END)
+        return -1;
+    memcpy(&header, in, sizeof(header));
+    if (header.version != FORMAT_VERSION || !(header.flags & FormatSignature))
+        return -1;
+    memcpy(signature, &in[sizeof(header)], SIGNATURE_SIZE);
+    return 0;
+}
+
+/*
+    ---
+    Tells if a text can be in a file with the signature
+    ---
+    text shorter than a trigram can't be told apart, it always could be there
+    returns 0 if it surely isn't in the file and 1 if it could be
+*/
+int SignatureMatches(const uint8_t* signature, const char* pattern, int len) {
+    for (int i = 0; i + 2 < len; i++) {
+        const int bit = TrigramBit(pattern[i], pattern[i+1], pattern[i+2]);
+        if (!(signature[bit / 8] & (1 << (bit % 8))))
+            return 0;
+    }
+    return 1;
+}
+
+// ----------------------------------------------------
+// internal functions
+// ----------------------------------------------------
+
+static int LengthAt(const uint8_t* lengths, int line) {
+    int value = 0;
+    for (int bit = 0; bit < LENGTH_BITS; bit++) {
+        const int pos = line * LENGTH_BITS + bit;
+        if (lengths[pos / 8] & (1 << (pos % 8)))
+            value |= 1 << bit;
+    }
+    return value;
+}
+
+static inline int TrigramBit(uint8_t a, uint8_t b, uint8_t c) {
+    const uint32_t hash = ((a << 16) | (b << 8) | c) * 0x9E3779B1u;
+    return hash >> (32 - SIGNATURE_BITS);
+}
+
+// sets a bit for every trigram of the text, full lines continue in the next one like in the editor
+static void MakeSignature(const FileData* file_data, int lines, uint8_t* signature) {
+    memset(signature, 0, SIGNATURE_SIZE);
+    // last two characters of the paragraph so far
+    uint8_t a = 0, b = 0;
+    int amount = 0;
+    for (int i = 0; i < lines; i++) {
+        const int len = file_data->line_lengths[i];
+        for (int j = 0; j < len; j++) {
+            const uint8_t c = file_data->data[i][j];
+            if (++amount >= 3) {
+                const int bit = TrigramBit(a, b, c);
+                signature[bit / 8] |= 1 << (bit % 8);
+            }
+            a = b;
+            b = c;
+        }
+        if (len < LINE_SIZE)
+            amount = 0;
+    }
+}
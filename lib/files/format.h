@@ -0,0 +1,21 @@
+#pragma once
+
+#include <inttypes.h>
+#include "files.h"
+
+// first byte of a v2 file, never found at the start of v1 rows (printable characters or 0xFF)
+#define FORMAT_VERSION (2)
+// trigrams of the text hashed into a bitmap, stored with every version (see format.c)
+#define SIGNATURE_SIZE (32)
+// header, signature and 5-bit line lengths
+#define FORMAT_OVERHEAD (12 + SIGNATURE_SIZE + (AMOUNT_OF_LINES * 5 + 7) / 8)
+// bytes at the start of a packed file that hold its signature
+#define SIGNATURE_END (12 + SIGNATURE_SIZE)
+// biggest packed file, with text that couldn't be compressed
+#define MAX_PACKED_SIZE (DATA_SIZE + FORMAT_OVERHEAD)
+
+int PackFile(const FileData* file_data, uint8_t* out, int size);
+int UnpackFile(const uint8_t* in, int len, FileData* file_data);
+void UnpackRows(const uint8_t* in, int len, FileData* file_data);
+int ReadSignature(const uint8_t* in, int len, uint8_t* signature);
+int SignatureMatches(const uint8_t* signature, const char* pattern, int len);
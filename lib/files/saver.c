@@ -0,0 +1,231 @@
+#include <string.h>
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "pico/util/queue.h"
+#include "files.h"
+#include "saver.h"
+#include "flash.h"
+#include "lcd.h"
+
+/*
+    Save service
+
+    Saves run on core1, so the editor and USB host stack on core0 keep going
+    while files are packed and written. File is copied into one of the job slots
+    and the slot goes to core1 through a queue. Successful jobs free their slot right away,
+    failed ones keep it until core0 takes the unsaved file back.
+    Deleting a file is a job too, its empty file is written over the old one after saves queued before it.
+    Newest job of a file replaces older ones, so only its failure gives the file back.
+    Name changes go to core1 through their own queue and are written before any save queued after them,
+    core1 keeps its own copy of the names as they are in flash.
+
+    Erase and program still can't run while the other core reads flash (XIP is off for
+    that time), store parks it with multicore lockout only for the operation itself (see store.c).
+    Core1 also does background work of the files (see FilesTask()) when there's nothing to save
+    and renders frames the editor publishes (see lcd.c), so core0 never waits for the display.
+    Newest frame goes first on every pass, saves and garbage collection render new frames
+    between single flash operations, so only a sector erase holds the display back.
+    Frames drawn meanwhile are dropped.
+*/
+
+#define SAVE_JOBS (2)
+// name changes waiting for core1, each takes only a few bytes
+#define NAME_JOBS (8)
+// how often core1 checks for background work while there are no saves
+#define IDLE_POLL_MS (100)
+
+typedef struct SaveJob {
+    volatile int pos;       // -1 while the slot is free
+    volatile int failed;    // set by core1, cleared by core0
+    volatile int dropped;   // file was deleted after the job was queued, failed save isn't given back
+    int deleting;           // job writes an empty file of a deleted one
+    FileData data;
+} SaveJob;
+
+typedef struct NameJob {
+    uint8_t pos;
+    uint8_t length;         // 0 for a deleted file
+    char name[LINE_SIZE];
+} NameJob;
+
+SaveJob save_jobs[SAVE_JOBS];
+// slot indexes of jobs that can take a new save
+queue_t free_jobs;
+// slot indexes waiting for core1
+queue_t queued_jobs;
+queue_t name_jobs;
+// names as they are in the directory in flash, only core1 uses it after initialization
+FilesInfo written_names;
+// every counter is written by one core only
+volatile uint32_t saves_queued = 0;
+volatile uint32_t saves_finished = 0;
+volatile uint32_t saves_succeeded = 0;
+uint32_t saves_reported = 0;
+// file saved by the newest successful job
+volatile int last_saved = -1;
+
+// internal functions
+static void QueueJob(FileData* file_data, int pos, int deleting);
+static void Render();
+static void SaverMain();
+
+// ----------------------------------------------------
+// functions exposed in the header file
+// ----------------------------------------------------
+
+// starts the service on core1, files have to be initialized and 'files_info' loaded first
+void SaverInitialize(const FilesInfo* files_info) {
+    memcpy(&written_names, files_info, sizeof(FilesInfo));
+    queue_init(&free_jobs, sizeof(uint8_t), SAVE_JOBS);
+    queue_init(&queued_jobs, sizeof(uint8_t), SAVE_JOBS);
+    queue_init(&name_jobs, sizeof(NameJob), NAME_JOBS);
+    for (uint8_t i = 0; i < SAVE_JOBS; i++) {
+        save_jobs[i].pos = -1;
+        queue_try_add(&free_jobs, &i);
+    }
+
+    // both cores have to be parked by the other one during flash writes
+    multicore_lockout_victim_init();
+    HandOverRendering();
+    multicore_launch_core1(SaverMain);
+}
+
+/*
+    ---
+    Hands a copy of the file over to core1
+    ---
+    waits only if all job slots are taken,
+    file is marked as saved right away, PollSave() gives it back if saving fails
+    older saves of the file still run first, if any of them fails its file is dropped
+    instead of being given back, this one has newer contents
+*/
+void QueueFileSave(FileData* file_data, int pos) {
+    QueueJob(file_data, pos, 0);
+}
+
+// hands the empty file of a deleted one over to core1 (see DeleteFile()), older saves of the file are dropped like above
+void QueueFileDelete(FileData* file_data, int pos) {
+    QueueJob(file_data, pos, 1);
+}
+
+/*
+    ---
+    Hands the name of a file over to core1, which writes it to the directory
+    ---
+    name is taken from 'files_info', which already has to hold the change
+    waits only if the queue is full
+*/
+void QueueFileName(const FilesInfo* files_info, int pos) {
+    NameJob job = { pos, files_info->name_lengths[pos], { 0 } };
+    memcpy(job.name, files_info->file_names[pos], job.length);
+    queue_add_blocking(&name_jobs, &job);
+}
+
+/*
+    ---
+    Checks for finished saves
+    ---
+    failed saves go first, their file is copied back into 'file_data' (with its changes still marked),
+    'pos' gets the index of the file
+    returns SaveNone if nothing finished since the last call
+*/
+SaveStatus PollSave(FileData* file_data, int* pos) {
+    for (uint8_t i = 0; i < SAVE_JOBS; i++) {
+        if (!save_jobs[i].failed)
+            continue;
+        const int dropped = save_jobs[i].dropped;
+        *pos = save_jobs[i].pos;
+        if (!dropped)
+            memcpy(file_data, &save_jobs[i].data, sizeof(FileData));
+        save_jobs[i].pos = -1;
+        save_jobs[i].failed = 0;
+        queue_add_blocking(&free_jobs, &i);
+        if (!dropped)
+            return SaveFailed;
+    }
+    if (saves_reported != saves_succeeded) {
+        saves_reported = saves_succeeded;
+        *pos = last_saved;
+        return SaveDone;
+    }
+    return SaveNone;
+}
+
+// returns amount of saves that didn't finish yet
+int SavesPending() {
+    return saves_queued - saves_finished;
+}
+
+// returns whether a file has a save that didn't finish yet (or failed and wasn't taken back)
+int FileSavePending(int pos) {
+    for (int i = 0; i < SAVE_JOBS; i++)
+        if (save_jobs[i].pos == pos)
+            return 1;
+    return 0;
+}
+
+// ----------------------------------------------------
+// internal functions
+// ----------------------------------------------------
+
+static void QueueJob(FileData* file_data, int pos, int deleting) {
+    for (uint8_t i = 0; i < SAVE_JOBS; i++) {
+        if (save_jobs[i].pos != pos)
+            continue;
+        save_jobs[i].dropped = 1;
+        // failed jobs belong to core0, so this one can be freed right away
+        if (save_jobs[i].failed) {
+            save_jobs[i].pos = -1;
+            save_jobs[i].failed = 0;
+            queue_add_blocking(&free_jobs, &i);
+        }
+    }
+
+    uint8_t job;
+    queue_remove_blocking(&free_jobs, &job);
+    save_jobs[job].pos = pos;
+    save_jobs[job].dropped = 0;
+    save_jobs[job].deleting = deleting;
+    memcpy(&save_jobs[job].data, file_data, sizeof(FileData));
+    memset(file_data->dirty_lines, 0, sizeof(file_data->dirty_lines));
+    file_data->dirty = 0;
+
+    saves_queued++;
+    queue_add_blocking(&queued_jobs, &job);
+}
+
+static void Render() {
+    RenderDisplay();
+}
+
+static void SaverMain() {
+    multicore_lockout_victim_init();
+    FlashSetYield(Render);
+    while (1) {
+        const int rendered = RenderDisplay();
+        NameJob name;
+        uint8_t job;
+        if (queue_try_remove(&name_jobs, &name)) {
+            // a deleted file loses its name before its data is emptied
+            WriteFileName(&written_names, name.pos, name.name, name.length);
+        } else if (queue_try_remove(&queued_jobs, &job)) {
+            SaveJob* save = &save_jobs[job];
+            const int result = WriteFileData(&save->data, save->pos);
+            if (result < 0 && !save->deleting) {
+                save->failed = 1;
+            } else {
+                // a delete that doesn't fit leaves the old data behind a deleted name, like it always did
+                if (result == 0 && !save->deleting) {
+                    last_saved = save->pos;
+                    saves_succeeded++;
+                }
+                save->pos = -1;
+                queue_add_blocking(&free_jobs, &job);
+            }
+            saves_finished++;
+        } else if (!FilesTask() && !rendered) {
+            // queue operations and published frames on core0 wake it up, the timeout lets background work start once input stops
+            best_effort_wfe_or_timeout(make_timeout_time_ms(IDLE_POLL_MS));
+        }
+    }
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "files.h"
+
+typedef enum SaveStatus {
+    SaveNone,       // no save finished since the last check
+    SaveDone,
+    SaveFailed      // storage was full, unsaved file is given back
+} SaveStatus;
+
+void SaverInitialize(const FilesInfo* files_info);
+void QueueFileSave(FileData* file_data, int pos);
+void QueueFileName(const FilesInfo* files_info, int pos);
+void QueueFileDelete(FileData* file_data, int pos);
+SaveStatus PollSave(FileData* file_data, int* pos);
+int SavesPending();
+int FileSavePending(int pos);
@@ -0,0 +1,822 @@
+#include <string.h>
+#include <stddef.h>
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+#include "store.h"
+#include "flash.h"
+#include "codec.h"
+
+/*
+    Log-structured file store
+
+    Every save appends a new version of the file to already erased space,
+    so saving costs a few page programs instead of an erase of a whole sector.
+
+    Flash is split into 256-byte blocks. First block of every sector holds the sector
+    header and a table describing extents (runs of blocks) stored in the rest of it.
+    A version of a file is made of one or more extents, so it only takes the blocks it uses.
+    Erased blocks that aren't taken yet are tracked in a free-space bitmap.
+
+    Data of a version always goes to erased blocks, the version only becomes visible
+    when its commit record (entry of the first extent, with a sequence number and a CRC)
+    is programmed, so a power cut at any point leaves the previous version in place.
+    Boot only reads the extent tables, newest version with a valid commit record
+    and all of its extents present wins.
+
+    Newest version of every slot is tracked in RAM, older ones are dead space
+    that gets reclaimed by garbage collection, which moves the live extents out of
+    a sector and erases it. New sectors are always taken from the least worn ones.
+*/
+
+#define SECTOR_MAGIC (0x5AA5C3E2) // can't collide with v1.0 files, which only contain ' '-'}' and 0xFF
+#define EXTENT_MAGIC (0xC35B)
+#define ERASED_WORD (0xFFFFFFFF)
+#define ERASED_HALF (0xFFFF)
+
+#define BLOCK_SIZE (FLASH_PAGE_SIZE)
+#define BLOCKS_PER_SECTOR (FLASH_SECTOR_SIZE / BLOCK_SIZE)
+// first block of a sector holds the header and the extent table, so there's one entry per every other block
+#define EXTENTS_PER_SECTOR (BLOCKS_PER_SECTOR - 1)
+#define TOTAL_BLOCKS (PERSISTENT_SECTORS * BLOCKS_PER_SECTOR)
+#define BLOCKS(len) (((len) + BLOCK_SIZE - 1) / BLOCK_SIZE)
+// marks an extent of a slot that wasn't found in any table
+#define NO_ENTRY (0xFF)
+
+// keep one sector free at all times, so garbage collection always has somewhere to move live extents to
+#define RESERVED_SECTORS (1)
+// background collection starts when there are less free sectors than that
+#define COLLECT_THRESHOLD (3)
+
+typedef struct SectorHeader {
+    uint32_t magic;
+    uint32_t erase_count;
+    uint32_t opened;        // cleared when the sector starts taking extents
+    uint32_t reserved;
+} SectorHeader;
+
+typedef struct ExtentHeader {
+    uint16_t magic;
+    uint8_t slot;
+    uint8_t part;           // position of the extent in its version
+    uint8_t parts;          // amount of extents making the version
+    uint8_t first_block;    // inside the sector
+    uint8_t blocks;
+    uint8_t flags;
+    uint16_t length;        // payload bytes in this extent
+    uint16_t check;         // CRC of the entry, tells apart entries cut off by a reset
+    uint32_t seq;           // newer versions have bigger numbers
+} ExtentHeader;
+
+// first block of every formatted sector
+typedef struct SectorTable {
+    SectorHeader header;
+    ExtentHeader extents[EXTENTS_PER_SECTOR];
+} SectorTable;
+
+typedef enum SectorState {
+    SectorFree,             // formatted and never written to since
+    SectorLog,              // formatted and taking (or holding) extents
+    SectorLegacy,           // v1.0 fixed 1KB slots, read in place
+    SectorUnknown,          // not formatted, has to be erased before use
+    SectorReserved          // not managed by the store
+} SectorState;
+
+typedef struct SectorInfo {
+    uint8_t state;
+    uint8_t free;           // erased blocks not taken by any extent
+    uint8_t live;           // blocks taken by newest versions
+    uint8_t extents;        // used entries of the extent table
+    uint32_t erase_count;
+} SectorInfo;
+
+typedef struct Extent {
+    uint16_t block;         // first block, counted from the start of the region
+    uint8_t blocks;
+    uint8_t entry;          // position in the sector's extent table
+    uint16_t length;
+} Extent;
+
+typedef struct SlotInfo {
+    uint32_t seq;           // 0 means v1.0 file, read in place
+    int8_t parts;           // -1 if never written
+    uint16_t length;
+    Extent extents[STORE_MAX_EXTENTS];
+} SlotInfo;
+
+SectorInfo sectors[PERSISTENT_SECTORS];
+SlotInfo slots[STORE_SLOTS];
+// erased blocks not taken by any extent, one bit each
+uint32_t free_map[TOTAL_BLOCKS / 32];
+// sector that currently takes new extents (-1 when none)
+int active_sector = -1;
+// sector being emptied by garbage collection, nothing can be put into it (-1 when none)
+int collected_sector = -1;
+// amount of sectors in SectorFree state
+int free_sectors = 0;
+// sequence number given to the next version
+uint32_t next_seq = 1;
+
+StoreCounters store_counters = { 0 };
+// bumped before and after every change that could move a version read through StoreMap()
+volatile uint32_t store_seq = 0;
+
+// internal functions
+static inline const uint8_t* RegionAt(uint32_t offset);
+static inline const SectorTable* TableAt(int sector);
+static inline int IsFree(int block);
+static inline void SetFree(int block, int free);
+static void ClearSlot(SlotInfo* info);
+static uint16_t ExtentCheck(const ExtentHeader* header);
+static int ExtentValid(const ExtentHeader* header);
+static int VersionComplete(const SlotInfo* info);
+static int FindVersion(int slot, uint32_t below);
+static void ReadSlot(const SlotInfo* info, int offset, uint8_t* buf, int len);
+static void ProgramExtentHeader(int block, int entry, const ExtentHeader* header);
+static void OpenSector(int sector);
+static void FormatSector(int sector);
+static void ScanSector(int sector);
+static void ScanLegacySector(int sector);
+static void SetSlotLive(int slot, int take);
+static int DeadBlocks(int sector);
+static int FindRun(int sector, int* first);
+static int PickSector(int blocks, int reserve);
+static int WriteVersion(int slot, const uint8_t* data, const SlotInfo* from, int len, int reserve);
+static int MoveExtent(int slot, int part);
+static inline void BeginChange();
+static inline void EndChange();
+
+// ----------------------------------------------------
+// functions exposed in the header file
+// ----------------------------------------------------
+
+// rebuilds the index from sector tables, doesn't touch file data
+void StoreInitialize() {
+    for (int i = 0; i < STORE_SLOTS; i++)
+        ClearSlot(&slots[i]);
+    memset(free_map, 0, sizeof(free_map));
+    active_sector = -1;
+    collected_sector = -1;
+    free_sectors = 0;
+    next_seq = 1;
+
+    for (int i = 0; i < PERSISTENT_SECTORS; i++) {
+        const SectorHeader* header = &TableAt(i)->header;
+        sectors[i] = (SectorInfo){ SectorUnknown, 0, 0, EXTENTS_PER_SECTOR, 0 };
+
+        // edit log and directory journal sectors
+        if (i >= EDITLOG_SECTOR && i <= NAMES_SECTOR) {
+            sectors[i].state = SectorReserved;
+        } else if (header->magic == SECTOR_MAGIC) {
+            sectors[i].erase_count = header->erase_count;
+            sectors[i].extents = 0;
+            if (header->opened == ERASED_WORD) {
+                sectors[i].state = SectorFree;
+                sectors[i].free = EXTENTS_PER_SECTOR;
+                for (int j = 1; j < BLOCKS_PER_SECTOR; j++)
+                    SetFree(i * BLOCKS_PER_SECTOR + j, 1);
+                free_sectors++;
+            } else {
+                sectors[i].state = SectorLog;
+            }
+        } else if (i >= LEGACY_FIRST_SECTOR) {
+            sectors[i].state = SectorLegacy;
+        }
+    }
+
+    // newest version of a slot is the one with the biggest sequence number whose first extent was written,
+    // it's written last, so every other part is already in flash
+    for (int i = 0; i < PERSISTENT_SECTORS; i++) {
+        if (sectors[i].state != SectorLog)
+            continue;
+        const SectorTable* table = TableAt(i);
+        for (int j = 0; j < EXTENTS_PER_SECTOR; j++) {
+            const ExtentHeader* header = &table->extents[j];
+            if (!ExtentValid(header))
+                continue;
+            if (header->seq >= next_seq)
+                next_seq = header->seq + 1;
+            SlotInfo* info = &slots[header->slot];
+            if (header->part == 0 && (info->parts < 0 || header->seq > info->seq)) {
+                info->seq = header->seq;
+                info->parts = header->parts;
+            }
+        }
+    }
+    for (int i = 0; i < PERSISTENT_SECTORS; i++)
+        if (sectors[i].state == SectorLog)
+            ScanSector(i);
+
+    for (int i = 0; i < STORE_SLOTS; i++) {
+        SlotInfo* info = &slots[i];
+        // a part went missing, version can't be read back, so the one before it is used
+        while (info->parts > 0 && !VersionComplete(info))
+            FindVersion(i, info->seq);
+        info->length = 0;
+        for (int j = 0; j < info->parts; j++)
+            info->length += info->extents[j].length;
+        SetSlotLive(i, 1);
+    }
+    // v1.0 files only count if the slot was never saved by the store
+    for (int i = LEGACY_FIRST_SECTOR; i < PERSISTENT_SECTORS; i++)
+        if (sectors[i].state == SectorLegacy)
+            ScanLegacySector(i);
+}
+
+/*
+    ---
+    Copies newest version of a file into the buffer
+    ---
+    bytes after the stored length are filled with 0xFF, like erased flash
+    returns the stored length
+*/
+int StoreRead(int slot, uint8_t* buf, int size) {
+    const SlotInfo* info = &slots[slot];
+    int len = 0;
+    if (info->parts >= 0) {
+        len = info->length < size ? info->length : size;
+        ReadSlot(info, 0, buf, len);
+    }
+    memset(&buf[len], 0xFF, size - len);
+    return len;
+}
+
+/*
+    ---
+    Gives the newest version of a file as it sits in flash (through XIP), without copying it
+    ---
+    only works for a version kept in a single extent, which is what most files take
+    pointer stays valid until the store changes, so the caller has to hold the files mutex while using it
+    or read 'store_seq' before and after, data is only valid if it was even and stayed the same
+    returns NULL if the version is split (or the file was never written), 'len' gets the stored length
+*/
+const uint8_t* StoreMap(int slot, int* len) {
+    const SlotInfo* info = &slots[slot];
+    if (info->parts != 1)
+        return NULL;
+    *len = info->length;
+    return RegionAt(info->extents[0].block * BLOCK_SIZE);
+}
+
+// returns length of the newest version of a file (0 if it was never written)
+int StoreSize(int slot) {
+    return slots[slot].parts < 0 ? 0 : slots[slot].length;
+}
+
+// returns sequence number of the newest version, it changes on every write (0 for v1.0 files and empty slots)
+uint32_t StoreVersion(int slot) {
+    return slots[slot].seq;
+}
+
+/*
+    ---
+    Appends a new version of a file
+    ---
+    collects garbage right away if there's no free space left
+    returns -1 when the store is full and 0 on success
+*/
+int StoreWrite(int slot, const uint8_t* data, int len) {
+    if (slot < 0 || slot >= STORE_SLOTS || len > STORE_MAX_PAYLOAD)
+        return -1;
+
+    while (WriteVersion(slot, data, NULL, len, RESERVED_SECTORS) < 0)
+        if (!StoreCollect())
+            return -1;
+    return 0;
+}
+
+// appends a new version only if it fits without collecting garbage (so without an erase), returns -1 if it doesn't and 0 on success
+int StoreTryWrite(int slot, const uint8_t* data, int len) {
+    if (slot < 0 || slot >= STORE_SLOTS || len > STORE_MAX_PAYLOAD)
+        return -1;
+    return WriteVersion(slot, data, NULL, len, RESERVED_SECTORS);
+}
+
+// returns whether there's anything worth doing for StoreCollect()
+int StoreNeedsCollecting() {
+    if (free_sectors >= COLLECT_THRESHOLD)
+        return 0;
+    // at least one sector has to have something to reclaim
+    for (int i = 0; i < PERSISTENT_SECTORS; i++)
+        if (DeadBlocks(i) > 0)
+            return 1;
+    return 0;
+}
+
+// size of the pool of erased sectors new versions are written to
+int StoreFreeSectors() {
+    return free_sectors;
+}
+
+/*
+    ---
+    Reclaims a single sector
+    ---
+    unformatted sectors go first, then the one with the most dead blocks,
+    live extents are moved out before the sector gets erased
+
+    returns 1 if a sector was freed and 0 if there was nothing to reclaim
+*/
+int StoreCollect() {
+    int victim = -1;
+    int most_dead = 0;
+    for (int i = 0; i < PERSISTENT_SECTORS; i++) {
+        const int dead = DeadBlocks(i);
+        if (dead > most_dead || (dead == most_dead && dead > 0 && sectors[i].erase_count < sectors[victim].erase_count)) {
+            victim = i;
+            most_dead = dead;
+        }
+    }
+    if (victim == -1)
+        return 0;
+
+    // move newest versions out of the sector, the reserve may be used for that
+    collected_sector = victim;
+    for (int i = 0; i < STORE_SLOTS; i++) {
+        const SlotInfo* info = &slots[i];
+        for (int j = 0; j < info->parts; j++) {
+            if (info->extents[j].block / BLOCKS_PER_SECTOR != victim)
+                continue;
+            int result;
+            if (info->seq == 0) {
+                // v1.0 files become a regular version
+                const SlotInfo from = *info;
+                result = WriteVersion(i, NULL, &from, from.length, 0);
+            } else {
+                result = MoveExtent(i, j);
+            }
+            if (result < 0) {
+                collected_sector = -1;
+                return 0;
+            }
+        }
+    }
+    collected_sector = -1;
+    FormatSector(victim);
+    return 1;
+}
+
+// erases every sector managed by the store, all files are lost
+void StoreFormat() {
+    for (int i = 0; i < PERSISTENT_SECTORS; i++)
+        if (sectors[i].state != SectorReserved)
+            FormatSector(i);
+    for (int i = 0; i < STORE_SLOTS; i++)
+        ClearSlot(&slots[i]);
+    active_sector = -1;
+}
+
+// ----------------------------------------------------
+// internal functions
+// ----------------------------------------------------
+
+static inline const uint8_t* RegionAt(uint32_t offset) {
+    return (const uint8_t*)(XIP_BASE + PERSISTENT_OFFSET + offset);
+}
+
+static inline const SectorTable* TableAt(int sector) {
+    return (const SectorTable*)RegionAt(sector * FLASH_SECTOR_SIZE);
+}
+
+static inline int IsFree(int block) {
+    return (free_map[block / 32] >> (block % 32)) & 1;
+}
+
+static inline void SetFree(int block, int free) {
+    if (free)
+        free_map[block / 32] |= 1u << (block % 32);
+    else
+        free_map[block / 32] &= ~(1u << (block % 32));
+}
+
+static void ClearSlot(SlotInfo* info) {
+    info->seq = 0;
+    info->parts = -1;
+    info->length = 0;
+    for (int i = 0; i < STORE_MAX_EXTENTS; i++)
+        info->extents[i] = (Extent){ 0, 0, NO_ENTRY, 0 };
+}
+
+// CRC-32 of the entry (with the check itself left erased), cut to 16 bits
+static uint16_t ExtentCheck(const ExtentHeader* header) {
+    ExtentHeader entry = *header;
+    entry.check = ERASED_HALF;
+    return Crc32(0, (const uint8_t*)&entry, sizeof(ExtentHeader));
+}
+
+// checks if an entry of an extent table was fully written
+static int ExtentValid(const ExtentHeader* header) {
+    return header->magic == EXTENT_MAGIC
+        && header->check == ExtentCheck(header)
+        && header->slot < STORE_SLOTS
+        && header->parts > 0 && header->parts <= STORE_MAX_EXTENTS && header->part < header->parts
+        && header->first_block > 0 && header->first_block + header->blocks <= BLOCKS_PER_SECTOR
+        && header->length <= header->blocks * BLOCK_SIZE;
+}
+
+// returns whether every extent of a version was found
+static int VersionComplete(const SlotInfo* info) {
+    for (int i = 0; i < info->parts; i++)
+        if (info->extents[i].entry == NO_ENTRY)
+            return 0;
+    return 1;
+}
+
+/*
+    ---
+    Looks up the newest version of a slot older than 'below'
+    ---
+    reads every extent table, so it's only used when the newest version is incomplete
+    leaves the slot cleared if there's no such version
+*/
+static int FindVersion(int slot, uint32_t below) {
+    SlotInfo* info = &slots[slot];
+    ClearSlot(info);
+    for (int i = 0; i < PERSISTENT_SECTORS; i++) {
+        if (sectors[i].state != SectorLog)
+            continue;
+        const SectorTable* table = TableAt(i);
+        for (int j = 0; j < EXTENTS_PER_SECTOR; j++) {
+            const ExtentHeader* header = &table->extents[j];
+            if (ExtentValid(header) && header->slot == slot && header->part == 0 && header->seq < below
+                && (info->parts < 0 || header->seq > info->seq)) {
+                info->seq = header->seq;
+                info->parts = header->parts;
+            }
+        }
+    }
+    if (info->parts < 0)
+        return 0;
+
+    for (int i = 0; i < PERSISTENT_SECTORS; i++) {
+        if (sectors[i].state != SectorLog)
+            continue;
+        const SectorTable* table = TableAt(i);
+        for (int j = 0; j < EXTENTS_PER_SECTOR; j++) {
+            const ExtentHeader* header = &table->extents[j];
+            if (ExtentValid(header) && header->slot == slot && header->seq == info->seq && header->parts == info->parts)
+                info->extents[header->part] = (Extent){
+                    i * BLOCKS_PER_SECTOR + header->first_block, header->blocks, j, header->length };
+        }
+    }
+    return 1;
+}
+
+// copies bytes of a version, starting at 'offset'
+static void ReadSlot(const SlotInfo* info, int offset, uint8_t* buf, int len) {
+    for (int i = 0; i < info->parts && len > 0; i++) {
+        const int span = info->extents[i].length;
+        if (offset >= span) {
+            offset -= span;
+            continue;
+        }
+        const int amount = span - offset < len ? span - offset : len;
+        memcpy(buf, RegionAt(info->extents[i].block * BLOCK_SIZE + offset), amount);
+        buf += amount;
+        len -= amount;
+        offset = 0;
+    }
+}
+
+// puts an entry into the extent table of the sector holding 'block', its check is filled in here
+static void ProgramExtentHeader(int block, int entry, const ExtentHeader* header) {
+    const int sector = block / BLOCKS_PER_SECTOR;
+    ExtentHeader checked = *header;
+    checked.check = ExtentCheck(header);
+    ProgramBytes(sector * FLASH_SECTOR_SIZE + offsetof(SectorTable, extents) + entry * sizeof(ExtentHeader),
+        (const uint8_t*)&checked, sizeof(ExtentHeader));
+}
+
+// marks a free sector as written to, so it's never mistaken for an erased one after reset
+static void OpenSector(int sector) {
+    const uint32_t opened = 0;
+    ProgramBytes(sector * FLASH_SECTOR_SIZE + offsetof(SectorHeader, opened), (const uint8_t*)&opened, sizeof(opened));
+}
+
+// erases a sector and puts a header with increased erase count in it
+static void FormatSector(int sector) {
+    SectorInfo* info = &sectors[sector];
+    const SectorHeader header = { SECTOR_MAGIC, info->erase_count + 1, ERASED_WORD, ERASED_WORD };
+
+    BeginChange();
+    EraseSector(sector);
+    ProgramBytes(sector * FLASH_SECTOR_SIZE, (const uint8_t*)&header, sizeof(header));
+    EndChange();
+
+    if (info->state != SectorFree)
+        free_sectors++;
+    if (sector == active_sector)
+        active_sector = -1;
+    *info = (SectorInfo){ SectorFree, EXTENTS_PER_SECTOR, 0, 0, header.erase_count };
+    for (int i = 1; i < BLOCKS_PER_SECTOR; i++)
+        SetFree(sector * BLOCKS_PER_SECTOR + i, 1);
+}
+
+/*
+    ---
+    Registers extents of the newest versions found in a sector
+    ---
+    blocks not described by the table are free only if they're still erased,
+    a power cut could have left data in them without an entry
+*/
+static void ScanSector(int sector) {
+    const SectorTable* table = TableAt(sector);
+    SectorInfo* info = &sectors[sector];
+    uint16_t taken = 0;
+
+    info->extents = 0;
+    for (int entry = 0; entry < EXTENTS_PER_SECTOR; entry++) {
+        const ExtentHeader* header = &table->extents[entry];
+        // entries of a version aren't programmed in order, so an erased one can be followed by more of them,
+        // new entries only go after the last one that was touched
+        const uint32_t* words = (const uint32_t*)header;
+        for (int i = 0; i < (int)(sizeof(ExtentHeader) / 4); i++)
+            if (words[i] != ERASED_WORD)
+                info->extents = entry + 1;
+        // entries cut off by a reset are skipped, their blocks stay dead until the sector is collected
+        if (!ExtentValid(header))
+            continue;
+        for (int i = 0; i < header->blocks; i++)
+            taken |= 1u << (header->first_block + i);
+
+        SlotInfo* slot = &slots[header->slot];
+        if (slot->parts > 0 && header->seq == slot->seq && header->parts == slot->parts)
+            slot->extents[header->part] = (Extent){
+                sector * BLOCKS_PER_SECTOR + header->first_block, header->blocks, entry, header->length };
+    }
+
+    for (int i = 1; i < BLOCKS_PER_SECTOR; i++) {
+        if (taken & (1u << i))
+            continue;
+        const uint32_t* words = (const uint32_t*)RegionAt(sector * FLASH_SECTOR_SIZE + i * BLOCK_SIZE);
+        int erased = 1;
+        for (int j = 0; j < BLOCK_SIZE / 4 && erased; j++)
+            erased = words[j] == ERASED_WORD;
+        if (erased) {
+            SetFree(sector * BLOCKS_PER_SECTOR + i, 1);
+            info->free++;
+        }
+    }
+}
+
+// registers v1.0 files of a sector, trimming empty lines at their end
+static void ScanLegacySector(int sector) {
+    const int files_per_sector = FLASH_SECTOR_SIZE / LEGACY_FILE_SIZE;
+    const int first_slot = (sector - LEGACY_FIRST_SECTOR) * files_per_sector;
+    enum { line_size = 16 };
+
+    for (int i = 0; i < files_per_sector; i++) {
+        const int slot = first_slot + i;
+        if (slots[slot].parts >= 0)
+            continue;
+        const uint32_t offset = sector * FLASH_SECTOR_SIZE + i * LEGACY_FILE_SIZE;
+        const uint8_t* data = RegionAt(offset);
+        // empty lines start with 0xFF
+        int len = LEGACY_FILE_SIZE;
+        while (len > 0 && data[len - line_size] == 0xFF)
+            len -= line_size;
+        if (len == 0)
+            continue;
+
+        // whole 1KB stays taken until the file is saved again
+        SlotInfo* info = &slots[slot];
+        info->seq = 0;
+        info->parts = 1;
+        info->length = len;
+        info->extents[0] = (Extent){ offset / BLOCK_SIZE, LEGACY_FILE_SIZE / BLOCK_SIZE, 0, len };
+        SetSlotLive(slot, 1);
+    }
+}
+
+// adds (or removes) blocks of a slot's newest version to live blocks of their sectors
+static void SetSlotLive(int slot, int take) {
+    const SlotInfo* info = &slots[slot];
+    for (int i = 0; i < info->parts; i++) {
+        const Extent* extent = &info->extents[i];
+        SectorInfo* sector = &sectors[extent->block / BLOCKS_PER_SECTOR];
+        if (take)
+            sector->live += extent->blocks;
+        else
+            sector->live -= extent->blocks;
+    }
+}
+
+// returns amount of blocks that can't be used until the sector gets erased
+static int DeadBlocks(int sector) {
+    const SectorInfo* info = &sectors[sector];
+    switch (info->state) {
+    case SectorLog:
+        // free blocks are no use without a free table entry
+        if (info->extents == EXTENTS_PER_SECTOR)
+            return EXTENTS_PER_SECTOR - info->live;
+        return EXTENTS_PER_SECTOR - info->free - info->live;
+    case SectorLegacy:
+        return BLOCKS_PER_SECTOR - info->live;
+    case SectorUnknown:
+        return BLOCKS_PER_SECTOR;
+    default:
+        return 0;
+    }
+}
+
+/*
+    ---
+    Finds the first run of free blocks in a sector
+    ---
+    returns its length and puts the first block of it in 'first'
+*/
+static int FindRun(int sector, int* first) {
+    const int base = sector * BLOCKS_PER_SECTOR;
+    int len = 0;
+    for (int i = 1; i < BLOCKS_PER_SECTOR; i++) {
+        if (IsFree(base + i)) {
+            if (len == 0)
+                *first = base + i;
+            len++;
+        } else if (len > 0) {
+            break;
+        }
+    }
+    return len;
+}
+
+/*
+    ---
+    Chooses a sector for the next extent
+    ---
+    first parameter 'blocks' is the smallest run of free blocks the sector needs to have
+    second parameter 'reserve' is the amount of free sectors that has to be left untouched
+
+    sector that takes extents at the moment goes first, then gaps left in other sectors,
+    then the least worn free sector
+    returns -1 when there's no sector to take
+*/
+static int PickSector(int blocks, int reserve) {
+    int first;
+    int best = -1;
+    int best_run = 0;
+    for (int i = 0; i < PERSISTENT_SECTORS; i++) {
+        const SectorInfo* info = &sectors[i];
+        if (info->state != SectorLog || i == collected_sector || info->extents == EXTENTS_PER_SECTOR)
+            continue;
+        const int run = FindRun(i, &first);
+        if (run < blocks)
+            continue;
+        if (i == active_sector)
+            return i;
+        if (best == -1 || run > best_run) {
+            best = i;
+            best_run = run;
+        }
+    }
+    if (best != -1)
+        return best;
+
+    if (free_sectors <= reserve)
+        return -1;
+    for (int i = 0; i < PERSISTENT_SECTORS; i++)
+        if (sectors[i].state == SectorFree && i != collected_sector
+            && (best == -1 || sectors[i].erase_count < sectors[best].erase_count))
+            best = i;
+    return best;
+}
+
+/*
+    ---
+    Writes a new version of a file
+    ---
+    data is taken from 'data' or, if it's NULL, from the version described by 'from'
+    blocks are planned first, so nothing gets programmed when there's not enough space,
+    entry of the first extent is programmed last, which makes the version visible
+    returns -1 when there's no space left
+*/
+static int WriteVersion(int slot, const uint8_t* data, const SlotInfo* from, int len, int reserve) {
+    SlotInfo version = { .seq = next_seq, .parts = 0, .length = len };
+    uint8_t opened[STORE_MAX_EXTENTS];
+    int remaining = BLOCKS(len);
+    int planned = 0;
+
+    // even an empty file takes one entry
+    do {
+        const int sector = version.parts < STORE_MAX_EXTENTS ? PickSector(remaining > 0, reserve) : -1;
+        if (sector == -1) {
+            // give back everything that was planned
+            for (int i = version.parts - 1; i >= 0; i--) {
+                const Extent* extent = &version.extents[i];
+                SectorInfo* info = &sectors[extent->block / BLOCKS_PER_SECTOR];
+                for (int j = 0; j < extent->blocks; j++)
+                    SetFree(extent->block + j, 1);
+                info->free += extent->blocks;
+                info->extents--;
+                if (opened[i]) {
+                    info->state = SectorFree;
+                    free_sectors++;
+                }
+            }
+            return -1;
+        }
+        SectorInfo* info = &sectors[sector];
+        opened[version.parts] = info->state == SectorFree;
+        if (info->state == SectorFree) {
+            info->state = SectorLog;
+            free_sectors--;
+        }
+        active_sector = sector;
+
+        int first = sector * BLOCKS_PER_SECTOR + 1;
+        int blocks = FindRun(sector, &first);
+        if (blocks > remaining)
+            blocks = remaining;
+        for (int i = 0; i < blocks; i++)
+            SetFree(first + i, 0);
+        info->free -= blocks;
+        const int length = blocks * BLOCK_SIZE < len - planned ? blocks * BLOCK_SIZE : len - planned;
+        version.extents[version.parts++] = (Extent){ first, blocks, info->extents++, length };
+        planned += length;
+        remaining -= blocks;
+    } while (remaining > 0);
+
+    // data of every extent goes first, then their entries
+    uint8_t page[BLOCK_SIZE];
+    int position = 0;
+    for (int i = 0; i < version.parts; i++) {
+        const Extent* extent = &version.extents[i];
+        if (opened[i])
+            OpenSector(extent->block / BLOCKS_PER_SECTOR);
+        for (int j = 0; j < extent->length; j += BLOCK_SIZE) {
+            const int amount = extent->length - j < BLOCK_SIZE ? extent->length - j : BLOCK_SIZE;
+            if (data != NULL) {
+                ProgramBytes(extent->block * BLOCK_SIZE + j, &data[position + j], amount);
+            } else {
+                ReadSlot(from, position + j, page, amount);
+                ProgramBytes(extent->block * BLOCK_SIZE + j, page, amount);
+            }
+        }
+        position += extent->length;
+    }
+    for (int i = version.parts - 1; i >= 0; i--) {
+        const Extent* extent = &version.extents[i];
+        const ExtentHeader header = { EXTENT_MAGIC, slot, i, version.parts,
+            extent->block % BLOCKS_PER_SECTOR, extent->blocks, 0xFF, extent->length, ERASED_HALF, version.seq };
+        ProgramExtentHeader(extent->block, extent->entry, &header);
+    }
+
+    next_seq++;
+    BeginChange();
+    SetSlotLive(slot, 0);
+    slots[slot] = version;
+    SetSlotLive(slot, 1);
+    EndChange();
+    return 0;
+}
+
+/*
+    ---
+    Moves one extent of a slot's newest version to another sector
+    ---
+    the copy keeps the same sequence number and position, so until the old one
+    gets erased both of them describe exactly the same data
+    returns -1 when there's no space left
+*/
+static int MoveExtent(int slot, int part) {
+    Extent* extent = &slots[slot].extents[part];
+    const int sector = PickSector(extent->blocks, 0);
+    if (sector == -1)
+        return -1;
+
+    SectorInfo* info = &sectors[sector];
+    if (info->state == SectorFree) {
+        info->state = SectorLog;
+        free_sectors--;
+        OpenSector(sector);
+    }
+    active_sector = sector;
+
+    int first = sector * BLOCKS_PER_SECTOR + 1;
+    FindRun(sector, &first);
+    for (int i = 0; i < extent->blocks; i++)
+        SetFree(first + i, 0);
+    info->free -= extent->blocks;
+    const Extent moved = { first, extent->blocks, info->extents++, extent->length };
+
+    ProgramBytes(moved.block * BLOCK_SIZE, RegionAt(extent->block * BLOCK_SIZE), moved.length);
+    const ExtentHeader header = { EXTENT_MAGIC, slot, part, slots[slot].parts,
+        moved.block % BLOCKS_PER_SECTOR, moved.blocks, 0xFF, moved.length, ERASED_HALF, slots[slot].seq };
+    ProgramExtentHeader(moved.block, moved.entry, &header);
+
+    sectors[extent->block / BLOCKS_PER_SECTOR].live -= extent->blocks;
+    info->live += extent->blocks;
+    BeginChange();
+    *extent = moved;
+    EndChange();
+    return 0;
+}
+
+static inline void BeginChange() {
+    store_seq++;
+    __dmb();
+}
+
+static inline void EndChange() {
+    __dmb();
+    store_seq++;
+}
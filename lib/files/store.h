@@ -0,0 +1,64 @@
+#pragma once
+
+#include <inttypes.h>
+#include "hardware/flash.h"
+
+/*
+    Layout of the PERSISTENT region (keep in sync with memmap_custom.ld)
+
+    It lives at the very end of the 2MB flash, so the v1.0 layout
+    (names sector followed by 64 fixed 1KB files) is still found at the same place:
+    sectors 0-11  - log store (space added in front of the old layout)
+    sectors 12-13 - edit log
+    sector 14     - directory journal
+    sector 15     - directory journal (v1.0 file names until the first change)
+    sectors 16-31 - log store (v1.0 files are read in place until they get collected)
+
+    Store space is handed out in 256-byte blocks (one flash page each), see store.c
+*/
+#define FLASH_TOTAL_SIZE (2048 * 1024)
+#define PERSISTENT_SIZE (128 * 1024)
+#define PERSISTENT_OFFSET (FLASH_TOTAL_SIZE - PERSISTENT_SIZE)
+#define PERSISTENT_SECTORS (PERSISTENT_SIZE / FLASH_SECTOR_SIZE)
+
+#define LEGACY_NAMES_OFFSET (FLASH_TOTAL_SIZE - 68 * 1024)
+#define LEGACY_DATA_OFFSET (FLASH_TOTAL_SIZE - 64 * 1024)
+#define LEGACY_FILE_SIZE (1024)
+
+#define NAMES_SECTOR ((LEGACY_NAMES_OFFSET - PERSISTENT_OFFSET) / FLASH_SECTOR_SIZE)
+// directory journal takes turns between these two, see directory.c
+#define JOURNAL_SECTOR (NAMES_SECTOR - 1)
+// first of the two sectors taken by the edit log, see editlog.c
+#define EDITLOG_SECTOR (JOURNAL_SECTOR - 2)
+#define LEGACY_FIRST_SECTOR ((LEGACY_DATA_OFFSET - PERSISTENT_OFFSET) / FLASH_SECTOR_SIZE)
+
+// amount of slots the store keeps versions for, one for every file and two for the edit log
+#define STORE_SLOTS (66)
+// first of the edit log slots, they take turns holding its checkpoints
+#define EDITLOG_SLOT (STORE_SLOTS - 2)
+// most extents a single version of a file can be split into
+#define STORE_MAX_EXTENTS (8)
+// biggest file the store takes, so garbage collection can always find room for it
+#define STORE_MAX_PAYLOAD (8 * 1024)
+
+// flash work done by the store since boot
+typedef struct StoreCounters {
+    uint32_t bytes_programmed;
+    uint32_t sectors_erased;
+} StoreCounters;
+
+extern StoreCounters store_counters;
+// odd while the index or the erased space changes, see StoreMap()
+extern volatile uint32_t store_seq;
+
+void StoreInitialize();
+int StoreRead(int slot, uint8_t* buf, int size);
+const uint8_t* StoreMap(int slot, int* len);
+int StoreSize(int slot);
+uint32_t StoreVersion(int slot);
+int StoreWrite(int slot, const uint8_t* data, int len);
+int StoreTryWrite(int slot, const uint8_t* data, int len);
+int StoreCollect();
+int StoreNeedsCollecting();
+int StoreFreeSectors();
+void StoreFormat();
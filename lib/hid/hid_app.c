@@ -6,6 +6,7 @@ https://github.com/hathach/tinyusb/blob/ae531a79f654d566790a4daae350730cdc0a01e9
 #include "tusb.h"
 #include "hid_keyboard.h"
 #include "editor.h"
+#include "loop.h"
 #include "bsp/board.h"
 
 //--------------------------------------------------------------------+
@@ -25,7 +26,12 @@ static struct {
 	tuh_hid_report_info_t report_info[MAX_REPORT];
 } hid_info[CFG_TUH_HID];
 
+// led blinks left after reports couldn't be requested
+static int error_blinks = 0;
+
 static void process_generic_report(uint8_t dev_addr, uint8_t instance, uint8_t const* report, uint16_t len);
+static void show_receive_error(void);
+static void blink_error(void);
 extern void handleKeyboardLed(uint8_t dev_addr, uint8_t instance,hid_keyboard_report_t const* report);
 
 //--------------------------------------------------------------------+
@@ -41,10 +47,7 @@ void tuh_hid_mount_cb(uint8_t dev_addr, uint8_t instance, uint8_t const* desc_re
 	board_led_write(1);
 	ProcessMount();
 	if ( !tuh_hid_receive_report(dev_addr, instance) ) {
-		for (int i = 0; i < 4; i++) {
-			board_led_write(i % 2);
-			sleep_ms(500);
-		}
+		show_receive_error();
 	}
 }
 
@@ -61,6 +64,7 @@ void tuh_hid_umount_cb(uint8_t dev_addr, uint8_t instance) {
 void tuh_hid_report_received_cb(uint8_t dev_addr, uint8_t instance, uint8_t const* report, uint16_t len) {
 	uint8_t const itf_protocol = tuh_hid_interface_protocol(dev_addr, instance);
 
+	ProcessInput();
 	switch (itf_protocol) {
 	case HID_ITF_PROTOCOL_KEYBOARD:
 		TU_LOG2("HID receive boot keyboard report\r\n");
@@ -76,13 +80,23 @@ void tuh_hid_report_received_cb(uint8_t dev_addr, uint8_t instance, uint8_t cons
 
 	// continue to request to receive report
 	if ( !tuh_hid_receive_report(dev_addr, instance) ) {
-		for (int i = 0; i < 4; i++) {
-			board_led_write(i % 2);
-			sleep_ms(500);
-		}
+		show_receive_error();
 	}
 }
 
+// blinks the led without holding up the run loop
+static void show_receive_error(void) {
+	error_blinks = 4;
+	LoopCancelTimer(blink_error);
+	LoopAddTimer(0, 500, blink_error);
+}
+
+static void blink_error(void) {
+	board_led_write(error_blinks % 2 == 1);
+	if (--error_blinks == 0)
+		LoopCancelTimer(blink_error);
+}
+
 //--------------------------------------------------------------------+
 // Generic Report
 //--------------------------------------------------------------------+
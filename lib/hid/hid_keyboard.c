@@ -64,12 +64,38 @@ void process_kbd_report(hid_keyboard_report_t const *report) {
 		if ( report->keycode[i] ) {
 			if ( find_key_in_report(&prev_report, report->keycode[i]) ) {
 				// exist in previous report means the current key is holding
-			} else {
-				// not existed in previous report means the current key is pressed
+			} else if (ProcessKeyPress()) {
+				// not existed in previous report means the current key is pressed (editor may ignore it while busy)
 				bool is_shift = report->modifier & (KEYBOARD_MODIFIER_LEFTSHIFT | KEYBOARD_MODIFIER_RIGHTSHIFT);
 				if(lockingKeys.capsLock) is_shift = !is_shift;
 
 				uint8_t ch = keycode2ascii[report->keycode[i]][is_shift ? 1 : 0];
+				const bool shift_held = report->modifier & (KEYBOARD_MODIFIER_LEFTSHIFT | KEYBOARD_MODIFIER_RIGHTSHIFT);
+				const bool ctrl_held = report->modifier & (KEYBOARD_MODIFIER_LEFTCTRL | KEYBOARD_MODIFIER_RIGHTCTRL);
+				const bool alt_held = report->modifier & (KEYBOARD_MODIFIER_LEFTALT | KEYBOARD_MODIFIER_RIGHTALT);
+
+				// keys moving the cursor select text with shift held, any other key stops selecting
+				// (except the ones working with the selection)
+				switch (report->keycode[i]) {
+				case HID_KEY_ARROW_RIGHT:
+				case HID_KEY_ARROW_LEFT:
+				case HID_KEY_ARROW_DOWN:
+				case HID_KEY_ARROW_UP:
+				case HID_KEY_PAGE_DOWN:
+				case HID_KEY_PAGE_UP:
+				case HID_KEY_HOME:
+				case HID_KEY_END:
+					ProcessSelect(shift_held && !alt_held);
+					break;
+				case HID_KEY_DELETE:
+				case HID_KEY_BACKSPACE:
+					break;
+				default:
+					if (!ctrl_held || (report->keycode[i] != HID_KEY_X && report->keycode[i] != HID_KEY_C && report->keycode[i] != HID_KEY_V))
+						ProcessSelect(0);
+					break;
+				}
+
 				switch (report->keycode[i]) {
 				case HID_KEY_ARROW_RIGHT:
 					ProcessArrowRight();
@@ -79,12 +105,19 @@ void process_kbd_report(hid_keyboard_report_t const *report) {
 					ProcessArrowLeft();
 					break;
 
+				// alt with up/down arrow moves the line with the cursor
 				case HID_KEY_ARROW_DOWN:
-					ProcessArrowDown();
+					if (alt_held)
+						ProcessMoveLine(0);
+					else
+						ProcessArrowDown();
 					break;
 
 				case HID_KEY_ARROW_UP:
-					ProcessArrowUp();
+					if (alt_held)
+						ProcessMoveLine(1);
+					else
+						ProcessArrowUp();
 					break;
 				case HID_KEY_ESCAPE:
 					ProcessEscape();
@@ -127,9 +160,34 @@ void process_kbd_report(hid_keyboard_report_t const *report) {
 					ProcessEnd();
 					break;
 
+				// next occurrence of the searched text, previous one with shift
+				case HID_KEY_F3:
+					ProcessSearchNext(shift_held);
+					break;
+
 				default:
-					if (ch >= ' ' && ch <= '}')
+					// ctrl+z undoes an edit, ctrl+y (or ctrl+shift+z) does it again, ctrl+f starts a search, ctrl+h a replace
+					// ctrl+x, ctrl+c and ctrl+v cut, copy and paste, ctrl+k removes a line and ctrl+d duplicates it
+					if (ctrl_held) {
+						if (report->keycode[i] == HID_KEY_Z && !shift_held)
+							ProcessUndo();
+						else if (report->keycode[i] == HID_KEY_Y || report->keycode[i] == HID_KEY_Z)
+							ProcessRedo();
+						else if (report->keycode[i] == HID_KEY_F)
+							ProcessSearch();
+						else if (report->keycode[i] == HID_KEY_H)
+							ProcessReplace();
+						else if (report->keycode[i] == HID_KEY_X || report->keycode[i] == HID_KEY_C)
+							ProcessCopy(report->keycode[i] == HID_KEY_X);
+						else if (report->keycode[i] == HID_KEY_V)
+							ProcessPaste();
+						else if (report->keycode[i] == HID_KEY_K)
+							ProcessDeleteLine();
+						else if (report->keycode[i] == HID_KEY_D)
+							ProcessDuplicateLine();
+					} else if (ch >= ' ' && ch <= '}') {
 						ProcessChar(ch);
+					}
 					break;
 				}
 				fflush(stdout); // flush right away, else nanolib will wait for newline
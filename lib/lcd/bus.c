@@ -0,0 +1,171 @@
+#include "bus.h"
+#include "lcd.h"
+
+#include "hardware/i2c.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "pico/stdlib.h"
+
+/*
+	Display bus queue
+
+	Transactions for the display are queued in a ring of bytes and sent by the I2C interrupt,
+	so whoever draws only waits when the ring is full. Every entry is:
+	- length of the transaction and time the display needs after it (3 bytes)
+	- bytes of the transaction (without the address, display is the only device on the bus)
+	Interrupt feeds the bytes into the TX FIFO, the last one with STOP, and takes the next entry
+	when the STOP is seen on the bus. If the display needs time after the entry (clear and return home
+	take 1.52 ms) the next one is taken by an alarm. Other commands are done in less than
+	the time of a byte at 100 kHz, so they need no waiting.
+	Both cores may queue transactions, a spin lock guards the ring and the state.
+*/
+
+#define QUEUE_SIZE (512)
+#define ENTRY_HEADER (3)
+
+typedef enum BusState {
+	BusIdle,
+	BusSending,
+	BusHolding
+} BusState;
+
+uint8_t bus_queue[QUEUE_SIZE];
+// ring positions only grow, (position % QUEUE_SIZE) is the byte in the ring
+// start of the entry being sent (or held after) and end of queued entries
+volatile uint32_t queue_head = 0;
+volatile uint32_t queue_tail = 0;
+// next byte of the entry going into the FIFO, end of the entry and time the display needs after it
+uint32_t send_pos = 0;
+uint32_t send_end = 0;
+uint32_t send_hold = 0;
+volatile BusState bus_state = BusIdle;
+spin_lock_t* bus_lock;
+
+// internal functions
+static void StartNext();
+static void EntryDone();
+static void BusIrq();
+static int64_t HoldDone(alarm_id_t id, void* user_data);
+
+// ----------------------------------------------------
+// functions exposed in the header file
+// ----------------------------------------------------
+
+// takes over i2c0 (already initialized) for the display, its interrupt runs on the calling core
+void BusInitialize() {
+	i2c_hw_t* hw = i2c_get_hw(i2c0);
+	hw->enable = 0;
+	hw->tar = LCD_ADDRESS;
+	hw->enable = 1;
+	hw->intr_mask = I2C_IC_INTR_MASK_M_STOP_DET_BITS | I2C_IC_INTR_MASK_M_TX_ABRT_BITS;
+	bus_lock = spin_lock_init(spin_lock_claim_unused(true));
+	irq_set_exclusive_handler(I2C0_IRQ, BusIrq);
+	irq_set_enabled(I2C0_IRQ, true);
+}
+
+/*
+	---
+	Queues a transaction
+	---
+	parameter 'hold_us' is time the display needs after it before it takes anything else
+	waits only while the ring is full
+*/
+void BusSend(const uint8_t* dta, int len, int hold_us) {
+	while (1) {
+		const uint32_t save = spin_lock_blocking(bus_lock);
+		if (QUEUE_SIZE - (queue_tail - queue_head) >= ENTRY_HEADER + len) {
+			uint32_t tail = queue_tail;
+			bus_queue[tail++ % QUEUE_SIZE] = len;
+			bus_queue[tail++ % QUEUE_SIZE] = hold_us & 0xFF;
+			bus_queue[tail++ % QUEUE_SIZE] = hold_us >> 8;
+			for (int i = 0; i < len; i++)
+				bus_queue[tail++ % QUEUE_SIZE] = dta[i];
+			queue_tail = tail;
+			if (bus_state == BusIdle)
+				StartNext();
+			spin_unlock(bus_lock, save);
+			return;
+		}
+		spin_unlock(bus_lock, save);
+		tight_loop_contents();
+	}
+}
+
+/*
+	---
+	Waits until everything queued reached the display (and the display is done with it)
+	---
+	can't be called with interrupts disabled on the core running the bus interrupt
+*/
+void BusFlush() {
+	while (bus_state != BusIdle)
+		tight_loop_contents();
+}
+
+// ----------------------------------------------------
+// internal functions
+// ----------------------------------------------------
+
+// takes the oldest queued entry, spin lock has to be held
+static void StartNext() {
+	if (queue_head == queue_tail) {
+		bus_state = BusIdle;
+		return;
+	}
+	const uint32_t head = queue_head;
+	send_pos = head + ENTRY_HEADER;
+	send_end = send_pos + bus_queue[head % QUEUE_SIZE];
+	send_hold = bus_queue[(head + 1) % QUEUE_SIZE] | (bus_queue[(head + 2) % QUEUE_SIZE] << 8);
+	bus_state = BusSending;
+	// FIFO is filled when it's empty
+	hw_set_bits(&i2c_get_hw(i2c0)->intr_mask, I2C_IC_INTR_MASK_M_TX_EMPTY_BITS);
+}
+
+// frees the room of the sent entry and goes on with the next one once the display is done with it
+static void EntryDone() {
+	uint32_t save = spin_lock_blocking(bus_lock);
+	queue_head = send_end;
+	if (send_hold == 0) {
+		StartNext();
+		spin_unlock(bus_lock, save);
+		return;
+	}
+	bus_state = BusHolding;
+	spin_unlock(bus_lock, save);
+	// alarm can't be added under the lock, it runs the callback right away if the time already passed
+	if (add_alarm_in_us(send_hold, HoldDone, NULL, true) < 0) {
+		busy_wait_us_32(send_hold);
+		save = spin_lock_blocking(bus_lock);
+		StartNext();
+		spin_unlock(bus_lock, save);
+	}
+}
+
+static void BusIrq() {
+	i2c_hw_t* hw = i2c_get_hw(i2c0);
+	const uint32_t status = hw->intr_stat;
+	if (status & I2C_IC_INTR_STAT_R_TX_ABRT_BITS) {
+		// display didn't take it, FIFO was flushed, rest of the entry is dropped
+		hw->clr_tx_abrt;
+		send_pos = send_end;
+	}
+	if (status & I2C_IC_INTR_STAT_R_TX_EMPTY_BITS) {
+		for (int room = i2c_get_write_available(i2c0); room > 0 && send_pos < send_end; room--, send_pos++)
+			hw->data_cmd = bus_queue[send_pos % QUEUE_SIZE] | (send_pos + 1 == send_end ? I2C_IC_DATA_CMD_STOP_BITS : 0);
+		if (send_pos == send_end)
+			hw_clear_bits(&hw->intr_mask, I2C_IC_INTR_MASK_M_TX_EMPTY_BITS);
+	}
+	if (status & (I2C_IC_INTR_STAT_R_STOP_DET_BITS | I2C_IC_INTR_STAT_R_TX_ABRT_BITS)) {
+		hw->clr_stop_det;
+		// STOP of an aborted entry may come after it was already done
+		if (bus_state == BusSending && send_pos == send_end)
+			EntryDone();
+	}
+}
+
+static int64_t HoldDone(alarm_id_t id, void* user_data) {
+	const uint32_t save = spin_lock_blocking(bus_lock);
+	StartNext();
+	spin_unlock(bus_lock, save);
+	return 0;
+}
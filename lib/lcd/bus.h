@@ -0,0 +1,7 @@
+#pragma once
+
+#include <inttypes.h>
+
+void BusInitialize();
+void BusSend(const uint8_t* dta, int len, int hold_us);
+void BusFlush();
@@ -1,7 +1,9 @@
 #include "lcd.h"
+#include "bus.h"
 #include <string.h>
 
 #include "hardware/i2c.h"
+#include "hardware/sync.h"
 #include "pico/binary_info.h"
 #include "pico/stdlib.h"
 
@@ -9,6 +11,74 @@ uint8_t displayfunction_; 	// stores current "function set" command  (datasheet
 uint8_t displaycontrol_;  	// stores current "display switch" command
 uint8_t displaymode_;		// stores current "input set" command
 
+/*
+	Shadow framebuffer
+
+	Text isn't sent as it's printed, it's drawn into a frame first. UpdateDisplay() publishes
+	a copy of the frame and RenderDisplay() compares the newest published one with what
+	the display shows and sends only the runs of changed cells.
+	A run goes in one I2C transaction: SetCursor command if the display's address isn't
+	already there, then data control byte and all characters of the run (the display
+	takes every byte after a control byte without "continuation" bit as data).
+	Redrawing a whole screen to change one character costs one character on the bus.
+	Frame is drawn left to right without autoscroll (entry mode set in InitializeDisplay()),
+	characters past the right edge of the display aren't kept. Cursor and blinking are part
+	of the frame, other commands go to the display right away.
+
+	Frames can be rendered on the other core (see HandOverRendering()), the one drawing them
+	never waits for it. Copies are published in turns into two slots, the renderer takes
+	the newest one and frames it didn't get to are dropped. Renderer checks that the slot it copied
+	wasn't written again meanwhile (a write into it starts two frames later) and copies it again if it was.
+*/
+
+// unchanged cells a run is sent over rather than split, starting another run costs 4 bytes
+#define RUN_GAP (3)
+
+typedef struct LcdFrame {
+	char cells[MAX_LINES][MAX_CHARS];
+	int col;			// display cursor
+	int row;
+	uint8_t control;	// "display switch" command (cursor and blinking)
+} LcdFrame;
+
+// drawing side
+char lcd_frame[MAX_LINES][MAX_CHARS];	// what was drawn
+// where the next character is drawn
+int frame_col = 0;
+int frame_row = 0;
+// set when something was drawn since the last published frame
+int frame_dirty = 1;
+// set once frames are rendered on the other core
+volatile int render_remote = 0;
+
+// published frames, the newest one is in slot (frame_seq % 2)
+LcdFrame published_frames[2];
+volatile uint32_t frame_seq = 0;
+// frame being written into its slot, it's frame_seq + 1 while a frame is published
+volatile uint32_t frame_writing = 0;
+
+// rendering side
+LcdFrame rendering;						// copy of the frame being rendered
+volatile uint32_t rendered_seq = 0;
+char lcd_shown[MAX_LINES][MAX_CHARS];	// what the display shows
+uint8_t control_shown;
+// DDRAM address of the display, column is -1 when it's unknown
+int address_col = -1;
+int address_row = 0;
+
+// bus traffic since the last update that sent something, of that update and of all since boot
+LcdStats lcd_pending;
+LcdStats lcd_last;
+LcdStats lcd_total;
+
+// internal functions
+static void PublishFrame();
+static int TakeFrame();
+static void MoveAddress(int col, int row);
+static void SendRun(int row, int start, int end);
+static void Send(const unsigned char* dta, int len, int hold_us);
+static void CommandHold(uint8_t value, int hold_us);
+
 void InitializeDisplay() {
 	// initiialize I2C protocol
 	i2c_init(i2c0, 100 * 1000); // running i2c0 at 100kHz
@@ -17,6 +87,8 @@ void InitializeDisplay() {
 	gpio_pull_up(I2C0_SDA);
 	gpio_pull_up(I2C0_SCL);
 	bi_decl(bi_2pins_with_func(I2C0_SDA, I2C0_SCL, GPIO_FUNC_I2C));
+	// everything is sent by the I2C interrupt from now on (see bus.c)
+	BusInitialize();
 
 	/*
 	Based on the block diagram at page 13 of:
@@ -25,66 +97,157 @@ void InitializeDisplay() {
 	sleep_ms(20);
 	
 	displayfunction_ = LCD_2LINE | LCD_5x8DOTS;
-	Command(LCD_FUNCTIONSET | displayfunction_);
-	sleep_us(50);
+	CommandHold(LCD_FUNCTIONSET | displayfunction_, 50);
 
 	displaycontrol_ = LCD_DISPLAYON | LCD_CURSOROFF | LCD_BLINKOFF;
-	Command(LCD_DISPLAYCONTROL | displaycontrol_);
-	sleep_us(50);
+	CommandHold(LCD_DISPLAYCONTROL | displaycontrol_, 50);
+	control_shown = displaycontrol_;
 
+	CommandHold(LCD_CLEARDISPLAY, 2000);  // clear display, set cursor position to zero
+	memset(lcd_shown, ' ', sizeof(lcd_shown));
+	address_col = 0;
+	address_row = 0;
 	ClearDisplay();
 	displaymode_ = LCD_ENTRYLEFT | LCD_ENTRYSHIFTDECREMENT;
 	Command(LCD_ENTRYMODESET | displaymode_);
+	FlushDisplay();
 }
 
-
-
+// clears the frame, display is only changed by UpdateDisplay()
 void ClearDisplay() {
-	Command(LCD_CLEARDISPLAY);  // clear display, set cursor position to zero
-	sleep_ms(2);
+	memset(lcd_frame, ' ', sizeof(lcd_frame));
+	frame_col = 0;
+	frame_row = 0;
+	frame_dirty = 1;
 }
 
+// moves where the next character is drawn to the start (display shift of the scroll commands stays)
 void Home() {
-	Command(LCD_RETURNHOME);  // set cursor position to zero
-	sleep_ms(2);
+	SetCursor(0, 0);
 }
 
+// moves where the next character is drawn, display cursor follows it in UpdateDisplay()
 void SetCursor(uint8_t col, uint8_t row) {
-	unsigned char val = (row == 0 ? col | 0x80 : col | 0x80 | 0x40);
-	unsigned char dta[2] = {LCD_SETDDRAMADDR, val};
-	SendByteS(dta, 2);
+	frame_col = col;
+	frame_row = row;
+	frame_dirty = 1;
+}
+
+/*
+	---
+	Publishes the frame if anything was drawn since the last time
+	---
+	call it once everything for the moment is drawn (after every keyboard report),
+	frame is rendered right away unless it's done on the other core
+*/
+void UpdateDisplay() {
+	if (!frame_dirty)
+		return;
+	PublishFrame();
+	if (render_remote)
+		__sev();	// renderer waits for events when it has nothing to do
+	else
+		RenderDisplay();
+}
+
+/*
+	---
+	Sends cells of the newest published frame that differ from the display
+	---
+	display cursor is left where the next character would be drawn
+	returns 0 if there was no new frame and 1 otherwise
+*/
+int RenderDisplay() {
+	if (!TakeFrame())
+		return 0;
+	for (int row = 0; row < MAX_LINES; row++) {
+		int col = 0;
+		while (col < MAX_CHARS) {
+			if (rendering.cells[row][col] == lcd_shown[row][col]) {
+				col++;
+				continue;
+			}
+			// run ends at the last changed cell before a longer gap
+			int end = col + 1;
+			for (int i = end; i < MAX_CHARS && i - end < RUN_GAP; i++)
+				if (rendering.cells[row][i] != lcd_shown[row][i])
+					end = i + 1;
+			SendRun(row, col, end);
+			col = end;
+		}
+	}
+	MoveAddress(rendering.col, rendering.row);
+	if (rendering.control != control_shown) {
+		Command(LCD_DISPLAYCONTROL | rendering.control);
+		control_shown = rendering.control;
+	}
+
+	if (lcd_pending.bytes > 0) {
+		lcd_last = lcd_pending;
+		memset(&lcd_pending, 0, sizeof(lcd_pending));
+	}
+	return 1;
+}
+
+/*
+	---
+	Frames are rendered by RenderDisplay() called on the other core from now on
+	---
+	commands outside the frame (scrolling, entry mode, custom characters) are better sent before
+*/
+void HandOverRendering() {
+	render_remote = 1;
 }
 
-// Turn the display on/off (quickly)
+/*
+	---
+	Waits until the frame and everything sent to the display got there
+	---
+	for sequences that have to be done before going on, it's called on the drawing core
+*/
+void FlushDisplay() {
+	UpdateDisplay();
+	while (rendered_seq != frame_seq)
+		tight_loop_contents();
+	BusFlush();
+}
+
+// copies bus traffic of the last update that sent something (so of one keystroke) and of all since boot
+void GetLcdStats(LcdStats* last, LcdStats* total) {
+	*last = lcd_last;
+	*total = lcd_total;
+}
+
+// Turn the display on/off (quickly), display switch goes with the frame
 void NoDisplay() {
 	displaycontrol_ &= ~LCD_DISPLAYON;
-	Command(LCD_DISPLAYCONTROL | displaycontrol_);
+	frame_dirty = 1;
 }
 
 void Display() {
 	displaycontrol_ |= LCD_DISPLAYON;
-	Command(LCD_DISPLAYCONTROL | displaycontrol_);
+	frame_dirty = 1;
 }
 
 void CursorOff() {
 	displaycontrol_ &= ~LCD_CURSORON;
-	Command(LCD_DISPLAYCONTROL | displaycontrol_);
+	frame_dirty = 1;
 }
 
 void CursorOn() {
 	displaycontrol_ |= LCD_CURSORON;
-	Command(LCD_DISPLAYCONTROL | displaycontrol_);
+	frame_dirty = 1;
 }
 
 // Turn on and off the blinking cursor
 void BlinkingOff() {
 	displaycontrol_ &= ~LCD_BLINKON;
-	Command(LCD_DISPLAYCONTROL | displaycontrol_);
+	frame_dirty = 1;
 }
 
 void BlinkingOn() {
 	displaycontrol_ |= LCD_BLINKON;
-	Command(LCD_DISPLAYCONTROL | displaycontrol_);
+	frame_dirty = 1;
 }
 
 // These commands scroll the display without changing the RAM
@@ -120,6 +283,8 @@ void NoAutoscroll(void) {
 }
 
 void CreateChar(uint8_t location, uint8_t charmap[]) {
+	// address points into CGRAM afterwards
+	address_col = -1;
 	location &= 0x7;  // we only have 8 locations (3 bytes used), so we discard any data after the 3th bit
 
 	// set CGRAM location to write into
@@ -142,31 +307,109 @@ inline void Command(uint8_t value) {
 	SendByteS(dta, 2);
 }
 
-// Print a character from font table
+// Print a character from font table (into the frame)
 void Write(uint8_t value) {
-	unsigned char dta[2] = {LCD_SETCGRAMADDR, value};
-	SendByteS(dta, 2);
+	if (frame_row < MAX_LINES && frame_col < MAX_CHARS)
+		lcd_frame[frame_row][frame_col] = value;
+	frame_col++;
+	frame_dirty = 1;
 }
 
 // Print a string
 void Print(const char* str) {
-	for (int i = 0; i < strlen(str); i++) {
-		unsigned char dta[2] = {LCD_SETCGRAMADDR, str[i]};
-		SendByteS(dta, 2);
-	}
+	for (; *str != '\0'; str++)
+		Write(*str);
 }
 
 void PrintN(const char* str, int len) {
-	for (int i = 0; i < len; i++) {
-		unsigned char dta[2] = {LCD_SETCGRAMADDR, str[i]};
-		SendByteS(dta, 2);
-	}
+	for (int i = 0; i < len; i++)
+		Write(str[i]);
 }
 
 void SendByte(unsigned char dta) {
-	i2c_write_blocking(i2c0, LCD_ADDRESS, &dta, 1, false);
+	SendByteS(&dta, 1);
 }
 
 void SendByteS(const unsigned char* dta, unsigned char len) {
-	i2c_write_blocking(i2c0, LCD_ADDRESS, dta, len, false);
+	Send(dta, len, 0);
+}
+
+/*********** internal functions */
+
+// copies the frame into the slot after the newest one
+static void PublishFrame() {
+	const uint32_t next = frame_seq + 1;
+	frame_writing = next;
+	__dmb();
+	LcdFrame* frame = &published_frames[next % 2];
+	memcpy(frame->cells, lcd_frame, sizeof(lcd_frame));
+	frame->col = frame_col;
+	frame->row = frame_row;
+	frame->control = displaycontrol_;
+	__dmb();
+	frame_seq = next;
+	frame_dirty = 0;
+}
+
+// copies the newest published frame to be rendered, returns 0 if it was rendered already
+static int TakeFrame() {
+	uint32_t seq;
+	do {
+		seq = frame_seq;
+		if (seq == rendered_seq)
+			return 0;
+		__dmb();
+		rendering = published_frames[seq % 2];
+		__dmb();
+	} while (frame_writing - seq >= 2);
+	lcd_pending.frames_dropped += seq - rendered_seq - 1;
+	lcd_total.frames_dropped += seq - rendered_seq - 1;
+	rendered_seq = seq;
+	return 1;
+}
+
+// queues a transaction, every one also takes the address byte on the bus
+static void Send(const unsigned char* dta, int len, int hold_us) {
+	const uint32_t start = time_us_32();
+	BusSend(dta, len, hold_us);
+	const uint32_t busy = time_us_32() - start;
+	lcd_pending.bytes += len + 1;
+	lcd_pending.transactions++;
+	lcd_pending.busy_us += busy;
+	lcd_total.bytes += len + 1;
+	lcd_total.transactions++;
+	lcd_total.busy_us += busy;
+}
+
+// sends a command the display needs 'hold_us' for before it takes anything else
+static void CommandHold(uint8_t value, int hold_us) {
+	unsigned char dta[2] = {LCD_SETDDRAMADDR, value};
+	Send(dta, 2, hold_us);
+}
+
+// sends SetCursor command unless the display's address is already there
+static void MoveAddress(int col, int row) {
+	if (address_col == col && address_row == row)
+		return;
+	unsigned char val = (row == 0 ? col | 0x80 : col | 0x80 | 0x40);
+	unsigned char dta[2] = {LCD_SETDDRAMADDR, val};
+	SendByteS(dta, 2);
+	address_col = col;
+	address_row = row;
+}
+
+// sends cells from 'start' to 'end' of a row of the frame in one transaction
+static void SendRun(int row, int start, int end) {
+	unsigned char dta[3 + MAX_CHARS];
+	int len = 0;
+	if (address_col != start || address_row != row) {
+		dta[len++] = LCD_SETDDRAMADDR;
+		dta[len++] = (row == 0 ? start | 0x80 : start | 0x80 | 0x40);
+	}
+	dta[len++] = LCD_SETCGRAMADDR;
+	memcpy(&dta[len], &rendering.cells[row][start], end - start);
+	memcpy(&lcd_shown[row][start], &rendering.cells[row][start], end - start);
+	SendByteS(dta, len + end - start);
+	address_col = end;
+	address_row = row;
 }
\ No newline at end of file
@@ -52,6 +52,14 @@
 #define TOP_ROW 0
 #define BOTTOM_ROW 1
 
+// I2C traffic to the display, address bytes included
+typedef struct LcdStats {
+	uint32_t bytes;
+	uint32_t transactions;
+	uint32_t busy_us;	// time spent waiting for room in the queue to the bus
+	uint32_t frames_dropped;	// published frames a newer one replaced before they were rendered
+} LcdStats;
+
 void InitializeDisplay();
 void ClearDisplay();
 void Home();
@@ -73,6 +81,11 @@ void Write(uint8_t val);
 void Command(uint8_t val);
 void Print(const char* str);
 void PrintN(const char* str, int len);
+void UpdateDisplay();
+int RenderDisplay();
+void HandOverRendering();
+void FlushDisplay();
+void GetLcdStats(LcdStats* last, LcdStats* total);
 
 void SendByte(unsigned char dta);
 void SendByteS(const unsigned char* dta, unsigned char len);
\ No newline at end of file
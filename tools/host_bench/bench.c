@@ -0,0 +1,389 @@
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
+#include "files.h"
+#include "codec.h"
+#include "format.h"
+#include "search.h"
+#include "document.h"
+
+/*
+    Host benchmark
+
+    Corpus text is cut into 16-character lines, the way the editor keeps it,
+    and into files of AMOUNT_OF_LINES lines. Every benchmark runs over all of them.
+    Times are in host TSC cycles when available, nanoseconds otherwise.
+*/
+
+#define MAX_FILES (256)
+#define REPEATS (200)
+// lengths of patterns searched for, taken from the corpus itself
+#define PATTERN_LENGTHS (4)
+#define PATTERNS (16)
+// replacements measured: lengths of the pattern and of the text replacing it
+#define REPLACEMENTS (4)
+
+FileData files[MAX_FILES];
+int file_lines[MAX_FILES];
+int amount_of_files = 0;
+// characters in all lines, line ends not counted
+long text_bytes = 0;
+
+#ifdef HAVE_TSC
+const char* time_unit = "cycles";
+#else
+const char* time_unit = "ns";
+#endif
+
+// internal functions
+static uint64_t Now();
+static int LoadCorpus(const char* path);
+static void BenchCodec();
+static int JoinLines(const FileData* file, int lines, char* text);
+static int NaiveSearch(const char* text, int len, const char* pattern, int pattern_len);
+static void BenchSearch();
+static int DocumentText(char* text);
+static int ReplaceByHand(const char* pattern, int len, const char* with, int with_len);
+static void BenchReplace();
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++)
+            if (LoadCorpus(argv[i]) < 0)
+                return 1;
+    } else if (LoadCorpus(DEFAULT_CORPUS) < 0) {
+        return 1;
+    }
+    printf("corpus: %d files, %ld characters\n", amount_of_files, text_bytes);
+
+    BenchCodec();
+    BenchSearch();
+    BenchReplace();
+    return 0;
+}
+
+// files.c needs the Pico SDK, the document only calls this when it's stored into a file
+void MarkLinesDirty(FileData* file_data, int from, int to) {
+    (void)file_data;
+    (void)from;
+    (void)to;
+}
+
+// ----------------------------------------------------
+// internal functions
+// ----------------------------------------------------
+
+static uint64_t Now() {
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+/*
+    ---
+    Splits a text file into editor files
+    ---
+    line breaks and full lines start a new line, tabs become spaces
+    and characters the keyboard can't type are dropped
+    returns -1 if the file can't be read
+*/
+static int LoadCorpus(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "can't open %s\n", path);
+        return -1;
+    }
+
+    FileData* current = NULL;
+    int line = AMOUNT_OF_LINES;
+    int col = 0;
+    int c;
+    while ((c = fgetc(file)) != EOF) {
+        if (c == '\t')
+            c = ' ';
+        if (c != '\n' && (c < ' ' || c > '}'))
+            continue;
+
+        if (c == '\n' || col == LINE_SIZE) {
+            line++;
+            col = 0;
+            if (c == '\n')
+                continue;
+        }
+        if (line >= AMOUNT_OF_LINES) {
+            if (amount_of_files == MAX_FILES)
+                break;
+            current = &files[amount_of_files];
+            file_lines[amount_of_files++] = 0;
+            memset(current->data, 0xFF, sizeof(current->data));
+            memset(current->line_lengths, 0, sizeof(current->line_lengths));
+            line = 0;
+        }
+        current->data[line][col++] = c;
+        current->line_lengths[line] = col;
+        file_lines[amount_of_files - 1] = line + 1;
+        text_bytes++;
+    }
+    fclose(file);
+    return 0;
+}
+
+// compression ratio and speed of the file format, compared to raw pages and v1.0 slots
+static void BenchCodec() {
+    static uint8_t packed[MAX_FILES][MAX_PACKED_SIZE];
+    static int packed_lengths[MAX_FILES];
+    static FileData unpacked;
+    long v1_bytes = 0;
+    long raw_bytes = 0;
+    long packed_bytes = 0;
+
+    for (int i = 0; i < amount_of_files; i++) {
+        const int pages = (file_lines[i] + LINES_PER_PAGE - 1) / LINES_PER_PAGE;
+        // v1.0 kept 64 lines in a fixed 1KB slot
+        v1_bytes += (file_lines[i] + 63) / 64 * 1024;
+        raw_bytes += pages * PAGE_SIZE;
+        packed_lengths[i] = PackFile(&files[i], packed[i], MAX_PACKED_SIZE);
+        packed_bytes += packed_lengths[i];
+
+        if (UnpackFile(packed[i], packed_lengths[i], &unpacked) < 0) {
+            printf("codec: file %d doesn't pass the checks\n", i);
+            return;
+        }
+        for (int j = 0; j < AMOUNT_OF_LINES; j++) {
+            if (unpacked.line_lengths[j] != files[i].line_lengths[j]
+                || memcmp(unpacked.data[j], files[i].data[j], LINE_SIZE) != 0) {
+                printf("codec: file %d line %d doesn't match after unpacking\n", i, j);
+                return;
+            }
+        }
+    }
+
+    uint64_t start = Now();
+    for (int r = 0; r < REPEATS; r++)
+        for (int i = 0; i < amount_of_files; i++)
+            PackFile(&files[i], packed[i], MAX_PACKED_SIZE);
+    const uint64_t pack_time = Now() - start;
+
+    start = Now();
+    for (int r = 0; r < REPEATS; r++)
+        for (int i = 0; i < amount_of_files; i++)
+            UnpackFile(packed[i], packed_lengths[i], &unpacked);
+    const uint64_t unpack_time = Now() - start;
+
+    const double kilobytes = (double)text_bytes * REPEATS / 1024;
+    printf("codec:\n");
+    printf("  v1.0 slots  %8ld bytes\n", v1_bytes);
+    printf("  raw pages   %8ld bytes\n", raw_bytes);
+    printf("  packed      %8ld bytes (%.1f%% of raw pages, %.1f%% of text)\n",
+        packed_bytes, 100.0 * packed_bytes / raw_bytes, 100.0 * packed_bytes / text_bytes);
+    printf("  pack        %8.0f %s/KB\n", pack_time / kilobytes, time_unit);
+    printf("  unpack      %8.0f %s/KB\n", unpack_time / kilobytes, time_unit);
+}
+
+// lines joined the way the document keeps them, a line break ends every line that isn't full
+static int JoinLines(const FileData* file, int lines, char* text) {
+    int len = 0;
+    for (int i = 0; i < lines; i++) {
+        memcpy(&text[len], file->data[i], file->line_lengths[i]);
+        len += file->line_lengths[i];
+        if (file->line_lengths[i] < LINE_SIZE)
+            text[len++] = '\n';
+    }
+    return len;
+}
+
+// byte by byte comparison at every position, what the search kernel is measured against
+static int NaiveSearch(const char* text, int len, const char* pattern, int pattern_len) {
+    for (int pos = 0; pos + pattern_len <= len; pos++)
+        if (memcmp(&text[pos], pattern, pattern_len) == 0)
+            return pos;
+    return -1;
+}
+
+/*
+    ---
+    Speed of the search kernel against a naive search
+    ---
+    patterns are cut out of random places of the corpus, so most of them are found somewhere,
+    every file is searched through for all matches (search goes on after every one found)
+*/
+static void BenchSearch() {
+    static char texts[MAX_FILES][DATA_SIZE + AMOUNT_OF_LINES];
+    static int text_lengths[MAX_FILES];
+    static const int lengths[PATTERN_LENGTHS] = { 1, 3, 8, 15 };
+    long total = 0;
+    for (int i = 0; i < amount_of_files; i++) {
+        text_lengths[i] = JoinLines(&files[i], file_lines[i], texts[i]);
+        total += text_lengths[i];
+    }
+    if (total == 0)
+        return;
+
+    printf("search:\n");
+    srand(1);
+    for (int l = 0; l < PATTERN_LENGTHS; l++) {
+        const int pattern_len = lengths[l];
+        char patterns[PATTERNS][16];
+        for (int p = 0; p < PATTERNS; p++) {
+            int file;
+            do {
+                file = rand() % amount_of_files;
+            } while (text_lengths[file] < pattern_len);
+            memcpy(patterns[p], &texts[file][rand() % (text_lengths[file] - pattern_len + 1)], pattern_len);
+        }
+
+        uint64_t times[2] = { 0, 0 };
+        long matches[2] = { 0, 0 };
+        for (int kernel = 0; kernel < 2; kernel++) {
+            const uint64_t start = Now();
+            for (int r = 0; r < REPEATS / 10; r++) {
+                for (int p = 0; p < PATTERNS; p++) {
+                    for (int i = 0; i < amount_of_files; i++) {
+                        int pos = 0;
+                        int found;
+                        while (pos < text_lengths[i]) {
+                            found = kernel == 0
+                                ? SearchForward(&texts[i][pos], text_lengths[i] - pos, patterns[p], pattern_len)
+                                : NaiveSearch(&texts[i][pos], text_lengths[i] - pos, patterns[p], pattern_len);
+                            if (found < 0)
+                                break;
+                            matches[kernel]++;
+                            pos += found + 1;
+                        }
+                    }
+                }
+            }
+            times[kernel] = Now() - start;
+        }
+        if (matches[0] != matches[1]) {
+            printf("  search: kernel found %ld matches, naive search %ld\n", matches[0], matches[1]);
+            return;
+        }
+        const double kilobytes = (double)total * PATTERNS * (REPEATS / 10) / 1024;
+        printf("  %2d chars    %8.0f %s/KB (naive %.0f), %ld matches\n", pattern_len,
+            times[0] / kilobytes, time_unit, times[1] / kilobytes, matches[0] / (REPEATS / 10));
+    }
+}
+
+// document rows joined into 'text' (line breaks after rows that aren't full), returns its length
+static int DocumentText(char* text) {
+    int len = 0;
+    for (int row = 0; row < AMOUNT_OF_LINES+1; row++) {
+        const int row_len = DocumentRow(row, &text[len]);
+        len += row_len;
+        if (row_len < LINE_SIZE)
+            text[len++] = '\n';
+    }
+    return len;
+}
+
+/*
+    ---
+    Replaces every occurrence the way it's done from the keyboard
+    ---
+    occurrence is found, its characters are deleted one by one and new ones typed in,
+    every key is a separate edit of the document (with its reflow and undo record)
+    returns amount of replaced occurrences or -1 if the text didn't fit
+*/
+static int ReplaceByHand(const char* pattern, int len, const char* with, int with_len) {
+    DocumentChange change;
+    int count = 0;
+    int row = 0;
+    int col = 0;
+    while (DocumentFind(pattern, len, row, col, 0, &row, &col) == 0) {
+        for (int i = 0; i < len; i++)
+            DocumentDelete(row, col, 0, &change);
+        for (int i = 0; i < with_len; i++) {
+            if (DocumentInsert(row, col, with[i], &change) < 0)
+                return -1;
+            // typing after the end of a full row continues in the next one
+            if (col == LINE_SIZE) {
+                row++;
+                col = 1;
+            } else {
+                col++;
+            }
+        }
+        count++;
+    }
+    return count;
+}
+
+/*
+    ---
+    Time of a replace-all against replacing every occurrence by hand
+    ---
+    patterns are cut out of the corpus, every file is loaded into the document again before each run,
+    results of both ways are compared, files where the result doesn't fit in a file are left out
+*/
+static void BenchReplace() {
+    static const int lengths[REPLACEMENTS][2] = { { 1, 1 }, { 3, 0 }, { 3, 3 }, { 3, 6 } };
+    static const char with[] = "######";
+    static char texts[MAX_FILES][DATA_SIZE + AMOUNT_OF_LINES];
+    static int text_lengths[MAX_FILES];
+    static char results[2][DATA_SIZE + 2*AMOUNT_OF_LINES];
+    for (int i = 0; i < amount_of_files; i++)
+        text_lengths[i] = JoinLines(&files[i], file_lines[i], texts[i]);
+
+    printf("replace all:\n");
+    srand(2);
+    for (int l = 0; l < REPLACEMENTS; l++) {
+        const int pattern_len = lengths[l][0];
+        const int with_len = lengths[l][1];
+        char patterns[PATTERNS][16];
+        for (int p = 0; p < PATTERNS; p++) {
+            int file;
+            int pos;
+            // line breaks can't be replaced
+            do {
+                file = rand() % amount_of_files;
+                pos = text_lengths[file] >= pattern_len ? rand() % (text_lengths[file] - pattern_len + 1) : 0;
+            } while (text_lengths[file] < pattern_len || memchr(&texts[file][pos], '\n', pattern_len) != NULL);
+            memcpy(patterns[p], &texts[file][pos], pattern_len);
+        }
+
+        uint64_t times[2] = { 0, 0 };
+        long replaced = 0;
+        int runs = 0;
+        for (int p = 0; p < PATTERNS; p++) {
+            for (int i = 0; i < amount_of_files; i++) {
+                DocumentChange change;
+                uint64_t start;
+                DocumentLoad(&files[i]);
+                start = Now();
+                const int count = DocumentReplaceAll(patterns[p], pattern_len, with, with_len, &change);
+                const uint64_t time = Now() - start;
+                if (count < 0)
+                    continue;
+                const int len = DocumentText(results[0]);
+
+                DocumentLoad(&files[i]);
+                start = Now();
+                const int by_hand = ReplaceByHand(patterns[p], pattern_len, with, with_len);
+                times[1] += Now() - start;
+                if (by_hand != count || DocumentText(results[1]) != len || memcmp(results[0], results[1], len) != 0) {
+                    printf("  replace all: result differs from replacing by hand\n");
+                    return;
+                }
+                times[0] += time;
+                replaced += count;
+                runs++;
+            }
+        }
+        if (runs == 0)
+            continue;
+        printf("  %d -> %d chars %8.0f %s/file (by hand %.0f), %.1f replaced per file\n", pattern_len, with_len,
+            (double)times[0] / runs, time_unit, (double)times[1] / runs, (double)replaced / runs);
+    }
+}